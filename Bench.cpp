@@ -0,0 +1,937 @@
+#include "stdafx.h"
+#include "DirectoryWatcher.hpp"
+#include "FileScanner.hpp"
+#include "LiteralPrefilter.hpp"
+#include "LockerQuery.hpp"
+#include "MetadataCache.hpp"
+#include "PatternSet.hpp"
+#include "ProcessList.hpp"
+#include "ProcessSource.hpp"
+#include "RescanScheduler.hpp"
+#include "WindowIndex.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+// Benchmarks for the scan engine: micro-benchmarks of the matchers, and
+// ProcessList polling synthetic process tables of up to 20,000 processes.
+//
+// Run the Release build of NSISLockDetectorBench; numbers are printed to
+// stdout, one line per measurement.
+
+// Every allocation made by the process, for allocations per poll
+static std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	++allocationCount;
+
+	void* p = malloc(size ? size : 1);
+
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	::operator delete(p);
+}
+
+// Reference matcher: the backtracking wildcmp() ProcessList used before
+// patterns were compiled into a PatternSet. Kept here as the baseline.
+//
+// http://xoomer.virgilio.it/acantato/dev/wildcard/wildmatch.html#evolution
+//
+static bool wildcmp(const wchar_t* pat, const wchar_t* str) {
+	wchar_t* s;
+	wchar_t* p;
+	bool star = false;
+
+loopStart:
+	for (s = const_cast<wchar_t*>(str), p = const_cast<wchar_t*>(pat); *s; ++s, ++p) {
+		switch (*p) {
+		case L'?':
+			if (*s == L'.') goto starCheck;
+			break;
+		case L'*':
+			star = true;
+			str = s, pat = p;
+			do { ++pat; } while (*pat == L'*');
+			if (!*pat) return true;
+			goto loopStart;
+		default:
+			if (towupper(*s) != towupper(*p))
+				goto starCheck;
+			break;
+		} /* endswitch */
+	} /* endfor */
+	while (*p == L'*') ++p;
+	return (!*p);
+
+starCheck:
+	if (!star) return false;
+	str++;
+	goto loopStart;
+}
+
+// Returns nanoseconds per call of fn(), which processes itemCount items
+static double measure(size_t itemCount, std::function<size_t()> fn)
+{
+	const auto minDuration = std::chrono::milliseconds(200);
+
+	size_t iterations = 0;
+	size_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	auto end = start;
+
+	do {
+		sink += fn();
+		++iterations;
+		end = std::chrono::steady_clock::now();
+	} while (end - start < minDuration);
+
+	if (sink == (size_t)-1) {
+		printf(" ");
+	}
+
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+	return ns / (double)(iterations * itemCount);
+}
+
+// Image paths of a typical desktop: services, shell, browsers, games, tools
+static std::vector<std::wstring> makePathCorpus(size_t count, unsigned seed)
+{
+	static const wchar_t* const prefixes[] = {
+		L"C:\\Windows\\System32\\",
+		L"C:\\Windows\\SysWOW64\\",
+		L"C:\\Windows\\",
+		L"C:\\Program Files\\Google\\Chrome\\Application\\",
+		L"C:\\Program Files (x86)\\Microsoft\\Edge\\Application\\",
+		L"C:\\Program Files\\WindowsApps\\Microsoft.WindowsTerminal_1.18.3181.0_x64__8wekyb3d8bbwe\\",
+		L"C:\\Program Files (x86)\\Steam\\",
+		L"C:\\Program Files\\NVIDIA Corporation\\NVIDIA GeForce Experience\\",
+		L"C:\\Users\\user\\AppData\\Local\\Discord\\app-1.0.9013\\",
+		L"C:\\Users\\user\\AppData\\Local\\Programs\\Microsoft VS Code\\",
+		L"C:\\Program Files\\obs-studio\\bin\\64bit\\",
+		L"C:\\Program Files\\obs-studio\\obs-plugins\\64bit\\",
+	};
+
+	static const wchar_t* const names[] = {
+		L"svchost.exe", L"RuntimeBroker.exe", L"explorer.exe", L"chrome.exe",
+		L"msedge.exe", L"steam.exe", L"steamwebhelper.exe", L"Discord.exe",
+		L"Code.exe", L"conhost.exe", L"dllhost.exe", L"nvcontainer.exe",
+		L"obs64.exe", L"obs-browser-page.exe", L"SearchHost.exe", L"ctfmon.exe",
+	};
+
+	std::mt19937 rng(seed);
+	std::vector<std::wstring> corpus;
+
+	for (size_t i = 0; i < count; ++i) {
+		corpus.emplace_back(
+			std::wstring(prefixes[rng() % std::size(prefixes)]) +
+			names[rng() % std::size(names)]);
+	}
+
+	return corpus;
+}
+
+// What an installer registers: a few extensions in each of a few folders
+static std::vector<std::wstring> makePatternSet(size_t count)
+{
+	static const wchar_t* const folders[] = {
+		L"bin\\64bit", L"bin\\32bit", L"obs-plugins\\64bit", L"obs-plugins\\32bit", L"data\\obs-plugins",
+	};
+
+	static const wchar_t* const extensions[] = {
+		L"*.exe", L"*.dll",
+	};
+
+	std::vector<std::wstring> patterns;
+
+	for (size_t i = 0; patterns.size() < count; ++i) {
+		std::wstring pattern = L"C:\\Program Files\\obs-studio";
+
+		if (i >= std::size(folders) * std::size(extensions)) {
+			pattern += L"\\plugin" + std::to_wstring(i);
+		}
+
+		pattern += L"\\";
+		pattern += folders[(i / std::size(extensions)) % std::size(folders)];
+		pattern += L"\\";
+		pattern += extensions[i % std::size(extensions)];
+
+		patterns.emplace_back(pattern);
+	}
+
+	return patterns;
+}
+
+static void benchPatternMatch()
+{
+	const auto corpus = makePathCorpus(2000, 1);
+
+	for (size_t patternCount : { 1, 2, 10, 50, 200, 500 }) {
+		const auto patterns = makePatternSet(patternCount);
+
+		PatternSet patternSet;
+		patternSet.add(patterns);
+
+		double baseline = measure(corpus.size(), [&]() {
+			size_t matches = 0;
+
+			for (auto& path : corpus) {
+				for (auto& pattern : patterns) {
+					if (wildcmp(pattern.c_str(), path.c_str())) {
+						++matches;
+						break;
+					}
+				}
+			}
+
+			return matches;
+		});
+
+		double compiled = measure(corpus.size(), [&]() {
+			size_t matches = 0;
+
+			for (auto& path : corpus) {
+				if (patternSet.match(path.c_str(), path.size())) {
+					++matches;
+				}
+			}
+
+			return matches;
+		});
+
+		printf("match/realistic patterns=%zu: wildcmp %.1f ns/path, PatternSet %.1f ns/path (%.1fx)\n",
+			patternCount, baseline, compiled, baseline / compiled);
+	}
+
+	// Star-heavy pattern against a long near-miss: wildcmp backtracks,
+	// PatternSet stays linear in the path length.
+	const std::wstring pattern = L"*a*a*a*a*a*a*b";
+
+	PatternSet patternSet;
+	patternSet.add(pattern);
+
+	for (size_t length : { 64, 256, 1024 }) {
+		const std::wstring path(length, L'a');
+
+		double baseline = measure(1, [&]() {
+			return (size_t)wildcmp(pattern.c_str(), path.c_str());
+		});
+
+		double compiled = measure(1, [&]() {
+			return (size_t)patternSet.match(path.c_str(), path.size());
+		});
+
+		printf("match/star-heavy length=%zu: wildcmp %.1f ns, PatternSet %.1f ns (%.1fx)\n",
+			length, baseline, compiled, baseline / compiled);
+	}
+}
+
+static void benchPrefilter()
+{
+	static const struct {
+		LiteralPrefilter::Kernel kernel;
+		const char* name;
+	} kernels[] = {
+		{ LiteralPrefilter::Scalar, "scalar" },
+		{ LiteralPrefilter::Sse2, "sse2" },
+		{ LiteralPrefilter::Avx2, "avx2" },
+	};
+
+	const auto corpus = makePathCorpus(2000, 2);
+
+	for (size_t patternCount : { 2, 10, 50, 500 }) {
+		const auto patterns = makePatternSet(patternCount);
+
+		LiteralPrefilter prefilter;
+		prefilter.build(patterns);
+
+		size_t rejected = 0;
+		for (auto& path : corpus) {
+			if (prefilter.test(path.c_str(), path.size()) == LiteralPrefilter::Reject) {
+				++rejected;
+			}
+		}
+
+		printf("prefilter/patterns=%zu: rejects %zu of %zu paths\n", patternCount, rejected, corpus.size());
+
+		for (auto& k : kernels) {
+			if (k.kernel > LiteralPrefilter::bestKernel()) {
+				continue;
+			}
+
+			prefilter.setKernel(k.kernel);
+
+			double ns = measure(corpus.size(), [&]() {
+				size_t count = 0;
+
+				for (auto& path : corpus) {
+					if (prefilter.test(path.c_str(), path.size()) == LiteralPrefilter::Reject) {
+						++count;
+					}
+				}
+
+				return count;
+			});
+
+			printf("prefilter/patterns=%zu %s: %.1f ns/path, %.2f M paths/s\n",
+				patternCount, k.name, ns, 1000.0 / ns);
+		}
+	}
+}
+
+// Resident set size right now, not the high-water mark, so it can be
+// compared before and after one phase
+static double rssMegabytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = { sizeof(counters) };
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+
+	return counters.WorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__linux__)
+	FILE* file = fopen("/proc/self/statm", "r");
+
+	if (!file) {
+		return 0;
+	}
+
+	long size = 0, resident = 0;
+	const bool read = fscanf(file, "%ld %ld", &size, &resident) == 2;
+
+	fclose(file);
+
+	return read ? resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0) : 0;
+#else
+	return 0;
+#endif
+}
+
+// Per-sample latencies and allocations of one phase, and the RSS before
+// its first and after its last sample
+class PhaseStats
+{
+public:
+	template <typename Fn>
+	void sample(Fn fn)
+	{
+		if (m_samples.empty()) {
+			m_rssBefore = rssMegabytes();
+		}
+
+		const size_t allocations = allocationCount;
+		auto start = std::chrono::steady_clock::now();
+
+		fn();
+
+		auto end = std::chrono::steady_clock::now();
+
+		m_allocations += allocationCount - allocations;
+		m_samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+
+		m_rssAfter = rssMegabytes();
+	}
+
+	void print(const char* phase, size_t processCount, size_t patternCount, double churn)
+	{
+		std::sort(m_samples.begin(), m_samples.end());
+
+		printf("engine/%s processes=%zu patterns=%zu churn=%.0f%%: "
+			"p50 %.1f us, p90 %.1f us, p99 %.1f us, %.1f allocs/call, RSS %.1f -> %.1f MB\n",
+			phase, processCount, patternCount, churn * 100.0,
+			percentile(0.50), percentile(0.90), percentile(0.99),
+			(double)m_allocations / (double)m_samples.size(),
+			m_rssBefore, m_rssAfter);
+	}
+
+private:
+	double percentile(double p) const
+	{
+		if (m_samples.empty()) {
+			return 0;
+		}
+
+		return m_samples[(size_t)(p * (double)(m_samples.size() - 1) + 0.5)];
+	}
+
+private:
+	std::vector<double> m_samples;
+	size_t m_allocations = 0;
+	double m_rssBefore = 0;
+	double m_rssAfter = 0;
+};
+
+// Drives a ProcessList over a synthetic process table. Every poll, a
+// fraction of the processes given by churn exits and as many new ones
+// start, some of them reusing the PIDs which were just freed.
+static void benchEngine()
+{
+	const size_t samples = 200;
+
+	for (size_t processCount : { 100, 1000, 5000, 20000 }) {
+		const auto corpus = makePathCorpus(processCount, 3);
+
+		for (size_t patternCount : { 1, 10, 500 }) {
+			const auto patterns = makePatternSet(patternCount);
+
+			for (double churn : { 0.0, 0.01, 0.10 }) {
+				std::mt19937 rng(4);
+
+				auto source = std::make_unique<FakeProcessSource>();
+				FakeProcessSource& table = *source;
+
+				std::vector<ProcessKey> running;
+				ProcessId nextId = 4;
+				uint64_t clock = 1;
+
+				for (size_t i = 0; i < processCount; ++i) {
+					running.push_back({ nextId, clock++ });
+					table.add(running.back(), corpus[i]);
+
+					nextId += 4;
+				}
+
+				ProcessList list(PsList, std::move(source), false);
+
+				PhaseStats initial, poll, rematch, fill;
+
+				initial.sample([&]() { list.addPatterns(patterns); });
+
+				std::vector<ProcessListItem> output;
+
+				for (size_t s = 0; s < samples; ++s) {
+					const size_t exits = (size_t)(churn * (double)processCount);
+
+					for (size_t i = 0; i < exits; ++i) {
+						ProcessKey& key = running[rng() % running.size()];
+
+						table.remove(key);
+
+						if (rng() % 2) {
+							key.id = nextId;
+							nextId += 4;
+						}
+
+						key.startTime = clock++;
+						table.add(key, corpus[rng() % corpus.size()]);
+					}
+
+					poll.sample([&]() { list.update(); });
+
+					output.clear();
+					fill.sample([&]() { list.fill(output); });
+				}
+
+				// Every pattern change re-matches all cached processes
+				for (size_t s = 0; s < 20; ++s) {
+					const std::wstring pattern = L"C:\\Program Files\\Vendor" + std::to_wstring(s) + L"\\*.exe";
+
+					rematch.sample([&]() { list.addPattern(pattern); });
+				}
+
+				initial.print("initial", processCount, patternCount, churn);
+				poll.print("poll", processCount, patternCount, churn);
+				rematch.print("rematch", processCount, patternCount, churn);
+				fill.print("fill", processCount, patternCount, churn);
+			}
+		}
+	}
+}
+
+// Sharded Restart Manager queries against a latency-modelled fake. The
+// model is scaled down from what a real session costs, the ratio of
+// session to per-file cost is what matters for the shard size.
+static void benchLockerQuery()
+{
+	const auto sessionCost = std::chrono::microseconds(2000);
+	const auto fileCost = std::chrono::microseconds(20);
+
+	for (size_t fileCount : { 500, 2000, 8000 }) {
+		std::vector<std::wstring> files;
+
+		for (size_t i = 0; i < fileCount; ++i) {
+			files.push_back(L"C:\\Program Files\\obs-studio\\bin\\64bit\\module" + std::to_wstring(i) + L".dll");
+		}
+
+		double baseline = 0;
+
+		for (size_t shardSize : { fileCount, (size_t)1024, (size_t)256, (size_t)64 }) {
+			for (size_t workers : { 1, 4, 8 }) {
+				if (shardSize > fileCount || (shardSize == fileCount && workers > 1)) {
+					continue;
+				}
+
+				auto backend = std::make_unique<FakeRestartManager>(sessionCost, fileCost);
+				FakeRestartManager& fake = *backend;
+
+				// Five processes, each holding files all over the list
+				for (size_t i = 0; i < fileCount; i += 7) {
+					fake.setLockers(files[i], { { (ProcessId)(4 + 4 * (i % 5)), 1 } });
+				}
+
+				LockerQuery query(std::move(backend), shardSize, workers);
+				std::vector<ProcessKey> lockers;
+
+				auto start = std::chrono::steady_clock::now();
+				bool result = query.query(files, lockers);
+				auto end = std::chrono::steady_clock::now();
+
+				const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+				if (!baseline) {
+					baseline = ms;
+				}
+
+				printf("rm/files=%zu shard=%zu workers=%zu: %.1f ms per poll (%.1fx), %zu sessions, %zu lockers%s\n",
+					fileCount, shardSize, workers, ms, baseline / ms, fake.sessions(), lockers.size(),
+					result ? "" : " FAILED");
+			}
+		}
+	}
+}
+
+// Icon and display name cache against a fake loader: 1,000 running
+// processes over a skewed set of executables, 10% of them replaced every
+// poll. Loads are what the cache saves, bytes show it keeps to its budget
+// once the entries in use fit in it.
+static void benchMetadataCache()
+{
+	const size_t processCount = 1000;
+	const size_t pollCount = 50;
+
+	for (size_t executableCount : { 50, 500, 5000 }) {
+		std::vector<PathId> paths;
+
+		for (size_t i = 0; i < executableCount; ++i) {
+			std::wstring path = L"C:\\Program Files\\app" + std::to_wstring(i) + L"\\app.exe";
+			paths.push_back(PathStore::shared().intern(path.c_str(), path.size()));
+		}
+
+		for (size_t budget : { 256 * 1024, 4 * 1024 * 1024 }) {
+			auto loader = std::make_unique<FakeMetadataLoader>(4096);
+			FakeMetadataLoader& fake = *loader;
+
+			MetadataCache cache(std::move(loader), budget);
+
+			std::mt19937 rng(1);
+			std::uniform_real_distribution<double> uniform(0, 1);
+
+			// A few executables run many processes, most run one
+			auto pick = [&] { return paths[(size_t)(executableCount * std::pow(uniform(rng), 3))]; };
+
+			std::vector<ProcessMetadataPtr> running;
+			size_t peakBytes = 0;
+
+			for (size_t i = 0; i < processCount; ++i) {
+				running.push_back(cache.acquire(pick()));
+			}
+
+			for (size_t poll = 0; poll < pollCount; ++poll) {
+				for (size_t i = 0; i < processCount / 10; ++i) {
+					running[rng() % processCount] = cache.acquire(pick());
+				}
+
+				peakBytes = (std::max)(peakBytes, cache.bytes());
+			}
+
+			const size_t acquires = cache.hits() + cache.misses();
+
+			printf("metadata/executables=%zu budget=%zuKB: %.1f%% hits, %zu loads for %zu acquires, %zu entries, peak %zuKB\n",
+				executableCount, budget / 1024, 100.0 * cache.hits() / acquires, fake.loads(), acquires,
+				cache.count(), peakBytes / 1024);
+		}
+	}
+}
+
+// Main window lookup for every listed process against synthetic window
+// lists: one walk over all windows per process, as Process used to do,
+// against one index build per refresh
+static void benchWindowIndex()
+{
+	for (size_t windowCount : { 200, 1000, 5000 }) {
+		for (size_t processCount : { 10, 100, 1000 }) {
+			auto source = std::make_unique<FakeWindowSource>();
+			FakeWindowSource& fake = *source;
+
+			std::mt19937 rng(1);
+
+			// Most windows are invisible helpers of a few hundred processes
+			for (size_t i = 0; i < windowCount; ++i) {
+				fake.add({ (WindowHandle)(i + 1), (ProcessId)(4 * (rng() % 500)), rng() % 4 == 0 },
+					L"Window " + std::to_wstring(i));
+			}
+
+			std::vector<WindowInfo> windows;
+			fake.enumerate(windows);
+
+			const double perProcess = measure(processCount, [&] {
+				size_t found = 0;
+
+				for (size_t p = 0; p < processCount; ++p) {
+					const ProcessId id = (ProcessId)(4 * p);
+
+					for (auto& window : windows) {
+						if (window.visible && window.owner == id) {
+							++found;
+							break;
+						}
+					}
+				}
+
+				return found;
+			});
+
+			WindowIndex index(std::move(source));
+
+			const double indexed = measure(processCount, [&] {
+				size_t found = 0;
+
+				index.refresh();
+
+				for (size_t p = 0; p < processCount; ++p) {
+					found += index.mainWindow((ProcessId)(4 * p)) != 0;
+				}
+
+				return found;
+			});
+
+			printf("windows/windows=%zu processes=%zu: per-process walk %.1f ns, index %.1f ns per process (%.1fx)\n",
+				windowCount, processCount, perProcess, indexed, perProcess / indexed);
+		}
+	}
+}
+
+// Replays an hour of a busy machine against each rescan policy on a fake
+// clock: a process starts every few seconds, one in ten of them locks a
+// file. Scans cost more while the machine is loaded. Latency runs from a
+// locking process starting to the end of the scan which finds it.
+static void benchScheduler()
+{
+	using std::chrono::milliseconds;
+	using std::chrono::microseconds;
+
+	struct Candidate
+	{
+		const char* name;
+		RescanPolicy policy;
+	};
+
+	std::vector<Candidate> candidates;
+
+	auto add = [&](const char* name, RescanPolicy policy) {
+		policy.warmup = milliseconds(0);
+		candidates.push_back({ name, policy });
+	};
+
+	RescanPolicy policy;
+
+	policy.cadence = RescanPolicy::Fixed;
+	policy.triggers = false;
+	policy.interval = milliseconds(1000);
+	add("fixed-1s", policy);
+
+	policy.interval = milliseconds(5000);
+	add("fixed-5s", policy);
+
+	policy = RescanPolicy();
+	policy.triggers = false;
+	add("adaptive", policy);
+
+	policy.cpuBudget = milliseconds(3000);
+	add("adaptive+budget", policy);
+
+	policy = RescanPolicy();
+	policy.cadence = RescanPolicy::Triggered;
+	policy.triggerDelay = milliseconds(250);
+	policy.maxInterval = milliseconds(30000);
+	add("triggered", policy);
+
+	policy.jitter = 0.2;
+	policy.cpuBudget = milliseconds(3000);
+	add("triggered+jitter+budget", policy);
+
+	policy = RescanPolicy();
+	add("adaptive+triggers", policy);
+
+	const auto length = std::chrono::hours(1);
+
+	for (auto& candidate : candidates) {
+		auto clock = std::make_unique<FakeSchedulerClock>();
+		FakeSchedulerClock& fake = *clock;
+
+		const SchedulerTime begin = fake.now();
+		const SchedulerTime end = begin + length;
+
+		RescanScheduler scheduler(std::move(clock), 1);
+		scheduler.setPolicy(candidate.policy);
+
+		std::mt19937 rng(1);
+		std::exponential_distribution<double> gap(1.0 / 5.0);
+
+		SchedulerTime nextStart = begin + microseconds((int64_t)(gap(rng) * 1e6));
+		std::vector<SchedulerTime> undetected;
+		std::vector<double> latencies;
+		microseconds cost{ 0 };
+		size_t scans = 0;
+
+		while (fake.now() < end) {
+			const SchedulerTime due = scheduler.next();
+
+			if (nextStart < due) {
+				fake.set(nextStart);
+
+				if (rng() % 10 == 0) {
+					undetected.push_back(nextStart);
+				}
+
+				scheduler.trigger();
+				nextStart += microseconds((int64_t)(gap(rng) * 1e6));
+				continue;
+			}
+
+			fake.set((std::max)(due, fake.now()));
+
+			// Loaded for ten minutes out of every thirty
+			const auto minute = std::chrono::duration_cast<std::chrono::minutes>(fake.now() - begin).count();
+			const microseconds duration((minute % 30) < 10 ? 600000 : 150000);
+			const SchedulerTime scanStart = fake.now();
+
+			fake.advance(duration);
+			scheduler.completed(duration, duration);
+
+			cost += duration;
+			++scans;
+
+			// Those which started while the scan ran are left to the next
+			undetected.erase(std::remove_if(undetected.begin(), undetected.end(), [&](SchedulerTime appeared) {
+				if (appeared > scanStart) {
+					return false;
+				}
+
+				latencies.push_back(std::chrono::duration<double>(fake.now() - appeared).count());
+				return true;
+			}), undetected.end());
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+
+		auto percentile = [&](double p) {
+			return latencies.empty() ? 0.0 : latencies[(size_t)(p * (double)(latencies.size() - 1) + 0.5)];
+		};
+
+		printf("scheduler/%s: %zu scans, %.2f s CPU per minute, latency p50 %.2f s, p90 %.2f s, max %.2f s\n",
+			candidate.name, scans, std::chrono::duration<double>(cost).count() / 60.0,
+			percentile(0.50), percentile(0.90), percentile(1.0));
+	}
+}
+
+// Forwards to the platform watcher, counting what it is asked and reports
+class CountingDirectoryWatcher : public DirectoryWatcher
+{
+public:
+	CountingDirectoryWatcher(std::unique_ptr<DirectoryWatcher> inner) : m_inner(std::move(inner)) {}
+
+	bool watch(const std::filesystem::path& directory) override
+	{
+		++watches;
+		return m_inner->watch(directory);
+	}
+
+	void unwatch(const std::filesystem::path& directory) override
+	{
+		m_inner->unwatch(directory);
+	}
+
+	bool poll(std::vector<std::filesystem::path>& changed,
+		std::vector<std::filesystem::path>& unwatched) override
+	{
+		const size_t changedBefore = changed.size();
+		const size_t unwatchedBefore = unwatched.size();
+		const bool complete = m_inner->poll(changed, unwatched);
+
+		events += changed.size() - changedBefore + unwatched.size() - unwatchedBefore;
+
+		return complete;
+	}
+
+	size_t watches = 0;
+	size_t events = 0;
+
+private:
+	std::unique_ptr<DirectoryWatcher> m_inner;
+};
+
+// Directory I/O of repeated RestartManager-mode file walks as the tree
+// changes: a scan after no change should read nothing, a change should
+// cost a read of the directories it touched, and a directory deleted and
+// created again must be watched again so later drops into it are seen.
+static void benchDirectoryWatcher()
+{
+	const size_t directoryCount = 200;
+	const size_t fileCount = 10;
+
+	const auto root = std::filesystem::temp_directory_path() / "NSISLockDetectorWatcherBench";
+	std::error_code ec;
+
+	std::filesystem::remove_all(root, ec);
+
+	for (size_t i = 0; i < directoryCount; ++i) {
+		const auto directory = root / ("dir" + std::to_string(i));
+
+		std::filesystem::create_directories(directory, ec);
+
+		for (size_t k = 0; k < fileCount; ++k) {
+			std::ofstream(directory / ("file" + std::to_string(k) + ".dll"));
+		}
+	}
+
+	auto counting = std::make_unique<CountingDirectoryWatcher>(DirectoryWatcher::create());
+	CountingDirectoryWatcher& watcher = *counting;
+
+	FileScanner scanner(std::move(counting));
+	scanner.setPatterns({ (root / "*.dll").wstring() });
+
+	const auto target = root / "dir7";
+
+	const std::vector<std::pair<const char*, std::function<void()>>> steps = {
+		{ "first", [] {} },
+		{ "unchanged", [] {} },
+		{ "file-added", [&] { std::ofstream(target / "added.dll"); } },
+		{ "directory-recreated", [&] {
+			std::filesystem::remove_all(target, ec);
+			std::filesystem::create_directories(target, ec);
+		} },
+		{ "file-added-after-recreate", [&] { std::ofstream(target / "late.dll"); } },
+		{ "unchanged", [] {} },
+	};
+
+	for (auto& step : steps) {
+		step.second();
+
+		const size_t reads = scanner.directoryReads();
+		const size_t watches = watcher.watches;
+		const size_t events = watcher.events;
+
+		std::vector<std::wstring> files;
+
+		const auto start = std::chrono::steady_clock::now();
+		scanner.scan(files);
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+
+		printf("watcher/%s: %zu files, %zu directories read, %zu watches added, %zu events, %.2f ms\n",
+			step.first, files.size(), scanner.directoryReads() - reads, watcher.watches - watches,
+			watcher.events - events, std::chrono::duration<double, std::milli>(elapsed).count());
+	}
+
+	std::filesystem::remove_all(root, ec);
+}
+
+// RestartManager-mode file walk over a synthetic install: plugins with
+// their DLLs under bin\ and a large data\ tree each. The same DLLs are
+// found with a recursive pattern, an exclusion of the data trees, and a
+// pattern which only looks at bin\.
+static void benchFileScanner()
+{
+	const size_t pluginCount = 40;
+	const size_t dataDirectoryCount = 25;
+	const size_t dataFileCount = 20;
+
+	const auto root = std::filesystem::temp_directory_path() / "NSISLockDetectorBench";
+	std::error_code ec;
+
+	std::filesystem::remove_all(root, ec);
+
+	for (size_t i = 0; i < pluginCount; ++i) {
+		const auto plugin = root / "obs-plugins" / ("plugin" + std::to_string(i));
+
+		std::filesystem::create_directories(plugin / "bin", ec);
+		std::ofstream(plugin / "bin" / "plugin.dll");
+
+		for (size_t j = 0; j < dataDirectoryCount; ++j) {
+			const auto data = plugin / "data" / ("locale" + std::to_string(j));
+
+			std::filesystem::create_directories(data, ec);
+
+			for (size_t k = 0; k < dataFileCount; ++k) {
+				std::ofstream(data / ("strings" + std::to_string(k) + (k % 4 ? ".ini" : ".dll")));
+			}
+		}
+	}
+
+	const std::wstring recursive = (root / "*.dll").wstring();
+
+	const std::vector<std::pair<const char*, std::vector<std::wstring>>> cases = {
+		{ "recursive", { recursive } },
+		{ "exclude-data", { recursive, L"!" + (root / "**" / "data" / "**").wstring() } },
+		{ "bin-only", { (root / "obs-plugins" / "*" / "bin" / "*.dll").wstring() } },
+	};
+
+	for (auto& c : cases) {
+		FileScanner scanner;
+		scanner.setPatterns(c.second);
+
+		std::vector<std::wstring> files;
+
+		const auto start = std::chrono::steady_clock::now();
+		scanner.scan(files);
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+
+		printf("filescan/%s: %zu files, %zu directories read, %zu pruned, %.2f ms\n",
+			c.first, files.size(), scanner.directoryReads(), scanner.directoriesPruned(),
+			std::chrono::duration<double, std::milli>(elapsed).count());
+	}
+
+	std::filesystem::remove_all(root, ec);
+}
+
+int main(void)
+{
+	benchPatternMatch();
+	benchPrefilter();
+	benchEngine();
+	benchLockerQuery();
+	benchMetadataCache();
+	benchWindowIndex();
+	benchDirectoryWatcher();
+	benchScheduler();
+	benchFileScanner();
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include "stdafx.h"
+#include "Metrics.hpp"
+#include "ProcessList.hpp"
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <clocale>
+#include <cstring>
+#endif
+
+// Command line driver over the scan engine, to time detection without an
+// installer around it:
+//
+//   NSISLockDetectorCli [--mode pslist|restartmanager|openfiles|modules] [--repeat N] [--stats] [--trace file.json] pattern...
+//
+// Prints "pid<TAB>path" for every process found and the duration of each
+// scan on stderr, followed by the engine's phase histograms with --stats.
+// --trace writes a Chrome trace-event timeline of the scans. Exits with 0
+// if nothing matched, 1 if something did and 2 on errors.
+
+static int usage()
+{
+	fwprintf(stderr, L"usage: NSISLockDetectorCli [--mode pslist|restartmanager|openfiles|modules] [--repeat N] [--stats] [--trace file.json] pattern...\n");
+
+	return 2;
+}
+
+static bool parseMode(const std::wstring& name, ProcessListMode& mode)
+{
+	static const struct
+	{
+		const wchar_t* name;
+		ProcessListMode mode;
+	} modes[] = {
+		{ L"pslist", PsList },
+		{ L"restartmanager", RestartManager },
+		{ L"openfiles", OpenFiles },
+		{ L"modules", Modules },
+	};
+
+	for (auto& entry : modes) {
+		if (name == entry.name) {
+			mode = entry.mode;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int run(const std::vector<std::wstring>& args)
+{
+	ProcessListMode mode = PsList;
+	size_t repeat = 1;
+	bool stats = false;
+	std::wstring tracePath;
+	std::vector<std::wstring> patterns;
+
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == L"--mode" && i + 1 < args.size()) {
+			if (!parseMode(args[++i], mode)) {
+				return usage();
+			}
+		}
+		else if (args[i] == L"--repeat" && i + 1 < args.size()) {
+			repeat = wcstoul(args[++i].c_str(), nullptr, 10);
+		}
+		else if (args[i] == L"--stats") {
+			stats = true;
+		}
+		else if (args[i] == L"--trace" && i + 1 < args.size()) {
+			tracePath = args[++i];
+		}
+		else if (args[i].compare(0, 2, L"--") == 0) {
+			return usage();
+		}
+		else {
+			patterns.push_back(args[i]);
+		}
+	}
+
+	if (patterns.empty() || !repeat) {
+		return usage();
+	}
+
+	std::vector<ProcessListItem> processes;
+
+	if (!tracePath.empty()) {
+		Trace::nameThread("main");
+		Trace::shared().start();
+	}
+
+	// Every scan starts cold, like an installer calling Query
+	for (size_t i = 0; i < repeat; ++i) {
+		processes.clear();
+
+		auto start = std::chrono::steady_clock::now();
+		bool result = ProcessList::query(mode, patterns, processes);
+		auto end = std::chrono::steady_clock::now();
+
+		if (!result) {
+			fwprintf(stderr, L"scan %zu failed\n", i + 1);
+			return 2;
+		}
+
+		fwprintf(stderr, L"scan %zu: %.1f ms, %zu processes\n", i + 1,
+			std::chrono::duration<double, std::milli>(end - start).count(), processes.size());
+	}
+
+	for (auto& process : processes) {
+		wprintf(L"%u\t%ls\n", (unsigned)process->id(), process->path());
+	}
+
+	if (stats) {
+		fwprintf(stderr, L"%hs", Metrics::shared().report().c_str());
+	}
+
+	if (!tracePath.empty() && !Trace::shared().write(tracePath)) {
+		fwprintf(stderr, L"cannot write %ls\n", tracePath.c_str());
+		return 2;
+	}
+
+	return processes.empty() ? 0 : 1;
+}
+
+#ifdef _WIN32
+
+int wmain(int argc, wchar_t** argv)
+{
+	return run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+
+#else
+
+int main(int argc, char** argv)
+{
+	setlocale(LC_ALL, "");
+
+	std::vector<std::wstring> args;
+
+	for (int i = 1; i < argc; ++i) {
+		std::vector<wchar_t> buf(strlen(argv[i]) + 1);
+		size_t len = mbstowcs(buf.data(), argv[i], buf.size());
+
+		args.emplace_back(buf.data(), len == (size_t)-1 ? 0 : len);
+	}
+
+	return run(args);
+}
+
+#endif
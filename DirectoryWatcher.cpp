@@ -0,0 +1,397 @@
+#include "stdafx.h"
+#include "DirectoryWatcher.hpp"
+
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <cwctype>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#ifdef _WIN32
+
+// One recursive ReadDirectoryChangesW per outermost watched directory;
+// directories below it are covered by the same handle.
+class Win32DirectoryWatcher : public DirectoryWatcher
+{
+public:
+	~Win32DirectoryWatcher()
+	{
+		for (auto& kv : m_roots) {
+			close(*kv.second);
+		}
+	}
+
+	bool watch(const std::filesystem::path& directory) override
+	{
+		const std::wstring k = key(directory);
+
+		if (m_covered.count(k)) {
+			return true;
+		}
+
+		for (auto& kv : m_roots) {
+			const std::wstring& rootKey = kv.first;
+
+			if (k.size() > rootKey.size() &&
+				k.compare(0, rootKey.size(), rootKey) == 0 &&
+				(k[rootKey.size()] == L'\\' || rootKey.back() == L'\\')) {
+				++kv.second->users;
+				m_covered[k] = kv.second.get();
+
+				return true;
+			}
+		}
+
+		auto root = std::make_unique<Root>();
+		root->path = directory;
+		root->buffer.resize(16384);
+		root->handle = CreateFileW(
+			directory.c_str(),
+			FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL,
+			OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+			NULL);
+
+		if (root->handle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		root->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (!root->overlapped.hEvent || !arm(*root)) {
+			close(*root);
+
+			return false;
+		}
+
+		root->users = 1;
+		m_covered[k] = root.get();
+		m_roots[k] = std::move(root);
+
+		return true;
+	}
+
+	void unwatch(const std::filesystem::path& directory) override
+	{
+		auto it = m_covered.find(key(directory));
+
+		if (it == m_covered.end()) {
+			return;
+		}
+
+		Root* root = it->second;
+		m_covered.erase(it);
+
+		if (--root->users == 0) {
+			close(*root);
+
+			for (auto rootIt = m_roots.begin(); rootIt != m_roots.end(); ++rootIt) {
+				if (rootIt->second.get() == root) {
+					m_roots.erase(rootIt);
+					break;
+				}
+			}
+		}
+	}
+
+	bool poll(std::vector<std::filesystem::path>& changed,
+		std::vector<std::filesystem::path>& unwatched) override
+	{
+		bool complete = true;
+
+		for (auto it = m_roots.begin(); it != m_roots.end(); ) {
+			Root& root = *it->second;
+
+			if (!root.armed) {
+				// Re-arming failed earlier, nothing can be trusted. The handle
+				// stays open on a deleted directory: drop the root, so the
+				// directories it covered are watched afresh.
+				complete = false;
+
+				if (!arm(root)) {
+					drop(it->second.get(), unwatched);
+					it = m_roots.erase(it);
+					continue;
+				}
+
+				++it;
+				continue;
+			}
+
+			DWORD bytes = 0;
+			if (!GetOverlappedResult(root.handle, &root.overlapped, &bytes, FALSE)) {
+				if (GetLastError() == ERROR_IO_INCOMPLETE) {
+					continue;
+				}
+
+				root.armed = false;
+				complete = false;
+			}
+			else if (bytes == 0) {
+				// Notification buffer overflowed
+				complete = false;
+			}
+			else {
+				const BYTE* pos = (const BYTE*)root.buffer.data();
+
+				for (;;) {
+					auto info = (const FILE_NOTIFY_INFORMATION*)pos;
+					std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+
+					changed.emplace_back((root.path / name).parent_path());
+
+					if (!info->NextEntryOffset) {
+						break;
+					}
+
+					pos += info->NextEntryOffset;
+				}
+			}
+
+			if (!arm(root)) {
+				complete = false;
+			}
+
+			++it;
+		}
+
+		return complete;
+	}
+
+private:
+	struct Root
+	{
+		std::filesystem::path path;
+		HANDLE handle = INVALID_HANDLE_VALUE;
+		OVERLAPPED overlapped = { 0 };
+		std::vector<DWORD> buffer;
+		size_t users = 0;
+		bool armed = false;
+	};
+
+	static std::wstring key(const std::filesystem::path& path)
+	{
+		std::wstring result = path.lexically_normal().wstring();
+
+		while (result.size() > 3 && result.back() == L'\\') {
+			result.pop_back();
+		}
+
+		for (auto& ch : result) {
+			ch = (wchar_t)towupper(ch);
+		}
+
+		return result;
+	}
+
+	// Closes a root and forgets the directories it covered
+	void drop(Root* root, std::vector<std::filesystem::path>& unwatched)
+	{
+		for (auto it = m_covered.begin(); it != m_covered.end(); ) {
+			if (it->second == root) {
+				unwatched.emplace_back(it->first);
+				it = m_covered.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+
+		close(*root);
+	}
+
+	static bool arm(Root& root)
+	{
+		ResetEvent(root.overlapped.hEvent);
+
+		root.armed = ReadDirectoryChangesW(
+			root.handle,
+			root.buffer.data(),
+			(DWORD)(root.buffer.size() * sizeof(DWORD)),
+			TRUE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME,
+			NULL,
+			&root.overlapped,
+			NULL) != FALSE;
+
+		return root.armed;
+	}
+
+	static void close(Root& root)
+	{
+		if (root.handle != INVALID_HANDLE_VALUE) {
+			if (root.armed) {
+				DWORD bytes;
+				CancelIoEx(root.handle, &root.overlapped);
+				GetOverlappedResult(root.handle, &root.overlapped, &bytes, TRUE);
+			}
+
+			CloseHandle(root.handle);
+			root.handle = INVALID_HANDLE_VALUE;
+		}
+
+		if (root.overlapped.hEvent) {
+			CloseHandle(root.overlapped.hEvent);
+			root.overlapped.hEvent = NULL;
+		}
+	}
+
+private:
+	std::map<std::wstring, std::unique_ptr<Root>> m_roots;
+	std::map<std::wstring, Root*> m_covered;
+};
+
+#elif defined(__linux__)
+
+// One inotify watch per directory
+class InotifyDirectoryWatcher : public DirectoryWatcher
+{
+public:
+	InotifyDirectoryWatcher()
+	{
+		m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+
+	~InotifyDirectoryWatcher()
+	{
+		if (m_fd >= 0) {
+			::close(m_fd);
+		}
+	}
+
+	bool watch(const std::filesystem::path& directory) override
+	{
+		if (m_fd < 0) {
+			return false;
+		}
+
+		int wd = inotify_add_watch(
+			m_fd,
+			directory.c_str(),
+			IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+
+		if (wd < 0) {
+			return false;
+		}
+
+		m_paths[wd] = directory;
+		m_watches[directory.native()] = wd;
+
+		return true;
+	}
+
+	void unwatch(const std::filesystem::path& directory) override
+	{
+		auto it = m_watches.find(directory.native());
+
+		if (it == m_watches.end()) {
+			return;
+		}
+
+		// A directory moved inside the tree keeps its watch descriptor,
+		// only drop it if no other path has taken it over
+		auto path = m_paths.find(it->second);
+		if (path != m_paths.end() && path->second.native() == directory.native()) {
+			inotify_rm_watch(m_fd, it->second);
+			m_paths.erase(path);
+		}
+
+		m_watches.erase(it);
+	}
+
+	bool poll(std::vector<std::filesystem::path>& changed,
+		std::vector<std::filesystem::path>& unwatched) override
+	{
+		if (m_fd < 0) {
+			return false;
+		}
+
+		bool complete = true;
+		alignas(inotify_event) char buf[16384];
+
+		for (;;) {
+			ssize_t len = read(m_fd, buf, sizeof(buf));
+
+			if (len <= 0) {
+				if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+					complete = false;
+				}
+
+				break;
+			}
+
+			for (char* pos = buf; pos < buf + len; ) {
+				auto event = (const inotify_event*)pos;
+				pos += sizeof(inotify_event) + event->len;
+
+				if (event->mask & IN_Q_OVERFLOW) {
+					complete = false;
+					continue;
+				}
+
+				auto it = m_paths.find(event->wd);
+				if (it == m_paths.end()) {
+					continue;
+				}
+
+				changed.emplace_back(it->second);
+
+				if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+					changed.emplace_back(it->second.parent_path());
+				}
+
+				// A moved directory keeps its watch under a path nobody
+				// asked for; a deleted one gets IN_IGNORED next. Either way
+				// the path is unwatched now.
+				if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+					if (event->mask & IN_MOVE_SELF) {
+						inotify_rm_watch(m_fd, event->wd);
+					}
+
+					unwatched.emplace_back(it->second);
+
+					m_watches.erase(it->second.native());
+					m_paths.erase(it);
+				}
+			}
+		}
+
+		return complete;
+	}
+
+private:
+	int m_fd = -1;
+	std::map<int, std::filesystem::path> m_paths;
+	std::map<std::filesystem::path::string_type, int> m_watches;
+};
+
+#endif
+
+// Fallback: nothing can be watched, every directory is read on every scan
+class NullDirectoryWatcher : public DirectoryWatcher
+{
+public:
+	bool watch(const std::filesystem::path&) override { return false; }
+	void unwatch(const std::filesystem::path&) override {}
+	bool poll(std::vector<std::filesystem::path>&, std::vector<std::filesystem::path>&) override { return true; }
+};
+
+std::unique_ptr<DirectoryWatcher> DirectoryWatcher::create()
+{
+#ifdef _WIN32
+	return std::make_unique<Win32DirectoryWatcher>();
+#elif defined(__linux__)
+	return std::make_unique<InotifyDirectoryWatcher>();
+#else
+	return std::make_unique<NullDirectoryWatcher>();
+#endif
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+// Reports directories whose list of entries changed.
+//
+// FileScanner watches every directory it has read and only re-reads the
+// ones reported here. Backends: inotify on Linux, ReadDirectoryChangesW on
+// Windows. Where no backend is available watch() fails and the caller
+// falls back to reading the directory on every scan.
+class DirectoryWatcher
+{
+public:
+	virtual ~DirectoryWatcher() {}
+
+	// Start watching a single directory. Returns false if changes to it
+	// cannot be reported.
+	virtual bool watch(const std::filesystem::path& directory) = 0;
+	virtual void unwatch(const std::filesystem::path& directory) = 0;
+
+	// Collects directories changed since the last poll, without blocking.
+	// Returns false if events were lost, in which case every watched
+	// directory has to be considered changed.
+	//
+	// unwatched gets the directories which are no longer watched, because
+	// they were deleted or moved away; a directory created again at the
+	// same path has to be watched again.
+	virtual bool poll(std::vector<std::filesystem::path>& changed,
+		std::vector<std::filesystem::path>& unwatched) = 0;
+
+	// Best watcher for this platform
+	static std::unique_ptr<DirectoryWatcher> create();
+};
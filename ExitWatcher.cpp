@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include "ExitWatcher.hpp"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#endif
+
+#ifdef _WIN32
+
+// Process handles spread over wait threads, each waiting on its wake event
+// and up to 63 processes
+class Win32ExitWatcher : public ExitWatcher
+{
+public:
+	Win32ExitWatcher(ProcessSource& source, Callback onExit) :
+		m_source(source),
+		m_onExit(onExit)
+	{
+	}
+
+	~Win32ExitWatcher()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+
+			m_stopping = true;
+
+			for (auto& group : m_groups) {
+				SetEvent(group->wake);
+			}
+		}
+
+		for (auto& group : m_groups) {
+			group->thread.join();
+
+			for (auto& entry : group->entries) {
+				CloseHandle(entry.handle);
+			}
+
+			CloseHandle(group->wake);
+		}
+	}
+
+	bool watch(const ProcessKey& key) override
+	{
+		HANDLE handle = OpenProcess(SYNCHRONIZE, FALSE, key.id);
+
+		if (!handle) {
+			return false;
+		}
+
+		// The open handle keeps the PID from being reused, so if the key
+		// matches now the handle is the right process
+		ProcessKey current;
+		if (!m_source.key(key.id, current) || !(current == key)) {
+			CloseHandle(handle);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		if (m_stopping || m_watches.count(key)) {
+			CloseHandle(handle);
+			return !m_stopping;
+		}
+
+		Group* group = nullptr;
+
+		for (auto& candidate : m_groups) {
+			if (candidate->entries.size() < MaxHandlesPerGroup) {
+				group = candidate.get();
+				break;
+			}
+		}
+
+		if (!group) {
+			auto created = std::make_unique<Group>();
+			created->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+			if (!created->wake) {
+				CloseHandle(handle);
+				return false;
+			}
+
+			group = created.get();
+			group->thread = std::thread(run, this, group);
+
+			m_groups.emplace_back(std::move(created));
+		}
+
+		group->entries.push_back({ key, handle, false });
+		m_watches[key] = group;
+
+		SetEvent(group->wake);
+
+		return true;
+	}
+
+	void unwatch(const ProcessKey& key) override
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		auto it = m_watches.find(key);
+
+		if (it == m_watches.end()) {
+			return;
+		}
+
+		// The handle may be waited on right now, its thread closes it
+		for (auto& entry : it->second->entries) {
+			if (entry.key == key) {
+				entry.removed = true;
+			}
+		}
+
+		SetEvent(it->second->wake);
+		m_watches.erase(it);
+	}
+
+private:
+	static const size_t MaxHandlesPerGroup = MAXIMUM_WAIT_OBJECTS - 1;
+
+	struct Entry
+	{
+		ProcessKey key;
+		HANDLE handle;
+		bool removed;
+	};
+
+	struct Group
+	{
+		HANDLE wake = NULL;
+		std::thread thread;
+		std::vector<Entry> entries;
+	};
+
+	static void run(Win32ExitWatcher* self, Group* group)
+	{
+		std::vector<HANDLE> handles;
+
+		for (;;) {
+			handles.assign(1, group->wake);
+
+			{
+				std::lock_guard<std::mutex> guard(self->m_mutex);
+
+				if (self->m_stopping) {
+					break;
+				}
+
+				for (auto it = group->entries.begin(); it != group->entries.end(); ) {
+					if (it->removed) {
+						CloseHandle(it->handle);
+						it = group->entries.erase(it);
+					}
+					else {
+						handles.push_back(it->handle);
+						++it;
+					}
+				}
+			}
+
+			DWORD result = WaitForMultipleObjects((DWORD)handles.size(), handles.data(), FALSE, INFINITE);
+
+			if (result == WAIT_OBJECT_0) {
+				continue;
+			}
+
+			std::vector<ProcessKey> exited;
+
+			{
+				std::lock_guard<std::mutex> guard(self->m_mutex);
+
+				for (auto it = group->entries.begin(); it != group->entries.end(); ) {
+					// A failed wait drops the whole group, polling covers it
+					bool signaled = result == WAIT_FAILED ||
+						(result > WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size() &&
+						it->handle == handles[result - WAIT_OBJECT_0]);
+
+					if (!signaled) {
+						++it;
+						continue;
+					}
+
+					if (!it->removed) {
+						exited.push_back(it->key);
+						self->m_watches.erase(it->key);
+					}
+
+					CloseHandle(it->handle);
+					it = group->entries.erase(it);
+				}
+			}
+
+			if (result != WAIT_FAILED) {
+				for (auto& key : exited) {
+					self->m_onExit(key);
+				}
+			}
+		}
+	}
+
+private:
+	ProcessSource& m_source;
+	Callback m_onExit;
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<Group>> m_groups;
+	std::map<ProcessKey, Group*> m_watches;
+	bool m_stopping = false;
+};
+
+#elif defined(__linux__)
+
+// One pidfd per process in a single epoll set, served by one thread
+class PidfdExitWatcher : public ExitWatcher
+{
+public:
+	PidfdExitWatcher(ProcessSource& source, Callback onExit) :
+		m_source(source),
+		m_onExit(onExit)
+	{
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		m_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+		if (m_epoll < 0 || m_wake < 0) {
+			return;
+		}
+
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = m_wake;
+
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &event) < 0) {
+			return;
+		}
+
+		m_thread = std::thread(run, this);
+	}
+
+	~PidfdExitWatcher()
+	{
+		if (m_thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				m_stopping = true;
+			}
+
+			uint64_t one = 1;
+			if (write(m_wake, &one, sizeof(one)) < 0) {
+				// Counter saturated, a wakeup is pending anyway
+			}
+
+			m_thread.join();
+		}
+
+		for (auto& kv : m_keys) {
+			close(kv.first);
+		}
+
+		if (m_wake >= 0) {
+			close(m_wake);
+		}
+
+		if (m_epoll >= 0) {
+			close(m_epoll);
+		}
+	}
+
+	bool watch(const ProcessKey& key) override
+	{
+		if (!m_thread.joinable()) {
+			return false;
+		}
+
+		int fd = (int)syscall(SYS_pidfd_open, (pid_t)key.id, 0);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		// The pidfd refers to whatever had the PID when it was opened
+		ProcessKey current;
+		if (!m_source.key(key.id, current) || !(current == key)) {
+			close(fd);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		if (m_watches.count(key)) {
+			close(fd);
+			return true;
+		}
+
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+			close(fd);
+			return false;
+		}
+
+		m_watches[key] = fd;
+		m_keys[fd] = key;
+
+		return true;
+	}
+
+	void unwatch(const ProcessKey& key) override
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		auto it = m_watches.find(key);
+
+		if (it == m_watches.end()) {
+			return;
+		}
+
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second, nullptr);
+		close(it->second);
+
+		m_keys.erase(it->second);
+		m_watches.erase(it);
+	}
+
+private:
+	static void run(PidfdExitWatcher* self)
+	{
+		epoll_event events[64];
+		std::vector<ProcessKey> exited;
+
+		for (;;) {
+			int count = epoll_wait(self->m_epoll, events, 64, -1);
+
+			exited.clear();
+
+			{
+				std::lock_guard<std::mutex> guard(self->m_mutex);
+
+				if (self->m_stopping) {
+					break;
+				}
+
+				for (int i = 0; i < count; ++i) {
+					const int fd = events[i].data.fd;
+					auto it = self->m_keys.find(fd);
+
+					if (it == self->m_keys.end()) {
+						continue;
+					}
+
+					// The fd may have been unwatched and its number reused
+					// since epoll_wait() returned
+					pollfd ready = { fd, POLLIN, 0 };
+					if (poll(&ready, 1, 0) <= 0) {
+						continue;
+					}
+
+					exited.push_back(it->second);
+
+					epoll_ctl(self->m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+					close(fd);
+
+					self->m_watches.erase(it->second);
+					self->m_keys.erase(it);
+				}
+			}
+
+			for (auto& key : exited) {
+				self->m_onExit(key);
+			}
+		}
+	}
+
+private:
+	ProcessSource& m_source;
+	Callback m_onExit;
+
+	int m_epoll = -1;
+	int m_wake = -1;
+	std::thread m_thread;
+
+	std::mutex m_mutex;
+	std::map<ProcessKey, int> m_watches;
+	std::map<int, ProcessKey> m_keys;
+	bool m_stopping = false;
+};
+
+#endif
+
+// Fallback: nothing can be watched, exits are found by polling
+class NullExitWatcher : public ExitWatcher
+{
+public:
+	bool watch(const ProcessKey&) override { return false; }
+	void unwatch(const ProcessKey&) override {}
+};
+
+std::unique_ptr<ExitWatcher> ExitWatcher::create(ProcessSource& source, Callback onExit)
+{
+#ifdef _WIN32
+	return std::make_unique<Win32ExitWatcher>(source, onExit);
+#elif defined(__linux__)
+	return std::make_unique<PidfdExitWatcher>(source, onExit);
+#else
+	return std::make_unique<NullExitWatcher>();
+#endif
+}
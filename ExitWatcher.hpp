@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <functional>
+#include <memory>
+
+// Reports the exit of individual processes as it happens.
+//
+// ProcessList watches every process it lists, so an entry disappears the
+// moment its process exits instead of on the next poll. Backends: pidfds
+// in an epoll set on Linux; on Windows groups of wait threads, each
+// blocking on up to 63 process handles, so the number of watched processes
+// is not limited by WaitForMultipleObjects. Where no backend is available
+// watch() fails and exits are only noticed by polling.
+class ExitWatcher
+{
+public:
+	typedef std::function<void(const ProcessKey& key)> Callback;
+
+	virtual ~ExitWatcher() {}
+
+	// Start watching a process. Returns false if it cannot be watched or
+	// is no longer running.
+	virtual bool watch(const ProcessKey& key) = 0;
+	virtual void unwatch(const ProcessKey& key) = 0;
+
+	// Best watcher for this platform. onExit is called once per watched
+	// process, from a thread of the watcher and without any of its locks
+	// held. source tells whether a PID still belongs to the watched
+	// process.
+	static std::unique_ptr<ExitWatcher> create(ProcessSource& source, Callback onExit);
+};
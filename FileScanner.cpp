@@ -0,0 +1,428 @@
+#include "stdafx.h"
+#include "FileScanner.hpp"
+
+#include <algorithm>
+#include <cwctype>
+
+FileScanner::~FileScanner()
+{
+	for (auto& kv : m_listings) {
+		if (kv.second.watched) {
+			m_watcher->unwatch(kv.second.path);
+		}
+	}
+}
+
+std::wstring FileScanner::key(const std::filesystem::path& path)
+{
+	std::wstring result = path.lexically_normal().wstring();
+
+	while (!result.empty() && (result.back() == L'\\' || result.back() == L'/') &&
+		std::filesystem::path(result).has_relative_path()) {
+		result.pop_back();
+	}
+
+	for (auto& ch : result) {
+		ch = (wchar_t)towupper(ch);
+	}
+
+	return result;
+}
+
+std::wstring FileScanner::fold(const std::wstring& name)
+{
+	std::wstring result = name;
+
+	for (auto& ch : result) {
+		ch = (wchar_t)towupper(ch);
+	}
+
+	return result;
+}
+
+void FileScanner::setPatterns(const std::vector<std::wstring>& patterns)
+{
+	// Cached listings do not depend on the patterns and are kept
+	m_globs.clear();
+	m_roots.clear();
+	m_walkRoots.clear();
+	m_states.clear();
+	m_stateIds.clear();
+
+	for (auto& pattern : patterns) {
+		addPattern(pattern);
+	}
+
+	// An ancestor's key sorts before its descendants', so the root a walk
+	// comes from is settled before the roots below it
+	std::map<std::wstring, size_t> arrivals;
+
+	for (auto& kv : m_roots) {
+		const Root& root = kv.second;
+
+		auto ancestor = m_roots.cend();
+		size_t depth = 0;
+
+		for (auto path = root.path; path.has_relative_path(); ++depth) {
+			path = path.parent_path();
+
+			ancestor = m_roots.find(key(path));
+			if (ancestor != m_roots.cend()) {
+				break;
+			}
+		}
+
+		std::vector<Position> positions;
+		bool reached = false;
+
+		// Follow the ancestor's walk down to this root
+		if (ancestor != m_roots.cend()) {
+			size_t current = arrivals[ancestor->first];
+			reached = walks(current);
+
+			std::vector<std::wstring> names;
+			for (auto& part : root.path) {
+				names.push_back(part.wstring());
+			}
+
+			for (size_t i = names.size() - depth - 1; i < names.size(); ++i) {
+				positions = child(current, names[i], fold(names[i]));
+
+				if (i + 1 < names.size()) {
+					current = intern(positions);
+					reached = reached && walks(current);
+				}
+			}
+		}
+
+		positions.insert(positions.end(), root.starts.begin(), root.starts.end());
+
+		const size_t arrival = intern(std::move(positions));
+		arrivals[kv.first] = arrival;
+
+		if (!reached && walks(arrival)) {
+			m_walkRoots.push_back({ root.path, kv.first, arrival });
+		}
+	}
+}
+
+void FileScanner::addPattern(const std::wstring& pattern)
+{
+	const bool exclude = !pattern.empty() && pattern[0] == L'!';
+
+	std::error_code ec;
+	auto full = std::filesystem::absolute(exclude ? pattern.substr(1) : pattern, ec).lexically_normal();
+
+	if (ec) {
+		return;
+	}
+
+	std::vector<std::wstring> names;
+
+	for (auto& part : full.relative_path()) {
+		if (!part.empty()) {
+			names.push_back(part.wstring());
+		}
+	}
+
+	if (names.empty()) {
+		return;
+	}
+
+	if (!full.has_filename()) {
+		names.push_back(L"**");
+	}
+
+	auto isWildcard = [](const std::wstring& name) {
+		return name.find_first_of(L"*?") != std::wstring::npos;
+	};
+
+	// The glob starts at the deepest directory without wildcards
+	auto base = full.root_path();
+	size_t first = 0;
+
+	while (first + 1 < names.size() && !isWildcard(names[first])) {
+		base /= names[first++];
+	}
+
+	Glob glob = { exclude, {} };
+
+	auto anyDepth = [&]() {
+		if (glob.segments.empty() || glob.segments.back().kind != Segment::AnyDepth) {
+			glob.segments.push_back({ Segment::AnyDepth, L"**" });
+		}
+	};
+
+	// Without wildcard directories the file wildcard applies at any depth
+	if (first + 1 == names.size()) {
+		anyDepth();
+	}
+
+	for (size_t i = first; i + 1 < names.size(); ++i) {
+		if (names[i] == L"**") {
+			anyDepth();
+		}
+		else if (isWildcard(names[i])) {
+			glob.segments.push_back({ Segment::Wildcard, names[i] });
+			glob.segments.back().wildcard.addNames({ names[i] });
+		}
+		else {
+			glob.segments.push_back({ Segment::Literal, fold(names[i]) });
+		}
+	}
+
+	if (names.back() == L"**") {
+		anyDepth();
+		glob.segments.push_back({ Segment::Wildcard, L"*" });
+	}
+	else {
+		glob.segments.push_back({ Segment::Wildcard, names.back() });
+	}
+
+	Root& root = m_roots[key(base)];
+
+	root.path = base;
+	root.starts.push_back({ (uint32_t)m_globs.size(), 0 });
+
+	m_globs.emplace_back(std::move(glob));
+}
+
+size_t FileScanner::intern(std::vector<Position> positions)
+{
+	// "**" may match no directory at all
+	for (size_t i = 0; i < positions.size(); ++i) {
+		const Position p = positions[i];
+
+		if (m_globs[p.glob].segments[p.segment].kind == Segment::AnyDepth) {
+			positions.push_back({ p.glob, p.segment + 1 });
+		}
+	}
+
+	std::sort(positions.begin(), positions.end());
+	positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+	auto it = m_stateIds.find(positions);
+	if (it != m_stateIds.end()) {
+		return it->second;
+	}
+
+	State state;
+	std::vector<std::wstring> included, excluded;
+
+	for (auto& p : positions) {
+		const Glob& glob = m_globs[p.glob];
+		const Segment& segment = glob.segments[p.segment];
+		const bool last = p.segment + 1 == glob.segments.size();
+
+		state.includes = state.includes || !glob.exclude;
+
+		if (last) {
+			(glob.exclude ? excluded : included).push_back(segment.name);
+		}
+		else if (segment.kind != Segment::AnyDepth) {
+			state.byName = true;
+		}
+		else if (glob.exclude && p.segment + 2 == glob.segments.size() && glob.segments.back().name == L"*") {
+			state.excludesAll = true;
+		}
+	}
+
+	state.includedFiles.addNames(included);
+	state.excludedFiles.addNames(excluded);
+	state.positions = positions;
+
+	m_states.emplace_back(std::move(state));
+	m_stateIds.emplace(std::move(positions), m_states.size() - 1);
+
+	return m_states.size() - 1;
+}
+
+std::vector<FileScanner::Position> FileScanner::child(size_t from, const std::wstring& name, const std::wstring& foldedName)
+{
+	std::vector<Position> output;
+
+	for (auto& p : m_states[from].positions) {
+		const Glob& glob = m_globs[p.glob];
+		const Segment& segment = glob.segments[p.segment];
+
+		if (p.segment + 1 == glob.segments.size()) {
+			continue;
+		}
+
+		switch (segment.kind) {
+		case Segment::AnyDepth:
+			output.push_back(p);
+			break;
+		case Segment::Literal:
+			if (segment.name == foldedName) {
+				output.push_back({ p.glob, p.segment + 1 });
+			}
+			break;
+		case Segment::Wildcard:
+			if (segment.wildcard.match(name.c_str(), name.size())) {
+				output.push_back({ p.glob, p.segment + 1 });
+			}
+			break;
+		}
+	}
+
+	return output;
+}
+
+size_t FileScanner::enter(size_t from, const std::wstring& name, const std::wstring& key)
+{
+	auto root = m_roots.find(key);
+
+	if (root == m_roots.end() && !m_states[from].byName) {
+		if (m_states[from].anyChild == NoState) {
+			const size_t next = intern(child(from, name, name));
+			m_states[from].anyChild = next;
+		}
+
+		return m_states[from].anyChild;
+	}
+
+	const size_t separator = key.find_last_of(L"\\/");
+	auto positions = child(from, name, separator == std::wstring::npos ? key : key.substr(separator + 1));
+
+	if (root != m_roots.end()) {
+		positions.insert(positions.end(), root->second.starts.begin(), root->second.starts.end());
+	}
+
+	return intern(std::move(positions));
+}
+
+void FileScanner::scan(std::vector<std::wstring>& output)
+{
+	++m_scanCount;
+
+	std::vector<std::filesystem::path> changed, unwatched;
+
+	if (!m_watcher->poll(changed, unwatched)) {
+		for (auto& kv : m_listings) {
+			kv.second.stale = true;
+		}
+	}
+
+	for (auto& directory : changed) {
+		auto it = m_listings.find(key(directory));
+
+		if (it != m_listings.end()) {
+			it->second.stale = true;
+		}
+	}
+
+	// Read and watched again if a directory turns up at the same path
+	for (auto& directory : unwatched) {
+		auto it = m_listings.find(key(directory));
+
+		if (it != m_listings.end()) {
+			it->second.stale = true;
+			it->second.watched = false;
+		}
+	}
+
+	for (auto& root : m_walkRoots) {
+		walk(root, output);
+	}
+
+	// Forget directories which are gone or no longer covered by a pattern
+	for (auto it = m_listings.begin(); it != m_listings.end(); ) {
+		if (it->second.visited != m_scanCount) {
+			if (it->second.watched) {
+				m_watcher->unwatch(it->second.path);
+			}
+
+			it = m_listings.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+const FileScanner::Listing& FileScanner::list(const std::filesystem::path& directory, const std::wstring& key)
+{
+	Listing& listing = m_listings[key];
+
+	listing.visited = m_scanCount;
+
+	if (!listing.stale && listing.watched) {
+		return listing;
+	}
+
+	// Watch before reading so no change can slip in between
+	if (!listing.watched) {
+		listing.path = directory;
+		listing.watched = m_watcher->watch(directory);
+	}
+
+	listing.files.clear();
+	listing.directories.clear();
+	listing.stale = false;
+
+	++m_directoryReads;
+
+	std::error_code ec;
+	std::filesystem::directory_iterator it(directory, ec);
+
+	for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+		auto& entry = *it;
+
+		std::error_code statusEc;
+
+		if (entry.is_directory(statusEc) && !entry.is_symlink(statusEc)) {
+			listing.directories.push_back({
+				entry.path().filename().wstring(),
+				FileScanner::key(entry.path()) });
+		}
+		else if (entry.is_regular_file(statusEc)) {
+			listing.files.emplace_back(entry.path().filename().wstring());
+		}
+	}
+
+	return listing;
+}
+
+void FileScanner::walk(const WalkRoot& top, std::vector<std::wstring>& output)
+{
+	struct Pending
+	{
+		std::filesystem::path path;
+		std::wstring key;
+		size_t state;
+	};
+
+	std::vector<Pending> stack;
+	stack.push_back({ top.path, top.key, top.state });
+
+	while (!stack.empty()) {
+		Pending dir = std::move(stack.back());
+		stack.pop_back();
+
+		const Listing& listing = list(dir.path, dir.key);
+
+		{
+			// Entering subdirectories below may add states and move this one
+			const State& state = m_states[dir.state];
+
+			for (auto& filename : listing.files) {
+				if (state.includedFiles.match(filename.c_str(), filename.size()) &&
+					!state.excludedFiles.match(filename.c_str(), filename.size())) {
+					output.emplace_back((dir.path / filename).wstring());
+				}
+			}
+		}
+
+		for (auto& subdirectory : listing.directories) {
+			const size_t next = enter(dir.state, subdirectory.name, subdirectory.key);
+
+			if (!walks(next)) {
+				++m_directoriesPruned;
+				continue;
+			}
+
+			stack.push_back({ dir.path / subdirectory.name, subdirectory.key, next });
+		}
+	}
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "PatternSet.hpp"
+#include "DirectoryWatcher.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <memory>
+#include <filesystem>
+
+// Finds the files matched by a set of path patterns.
+//
+// "<directory>\<file wildcard>" applies the wildcard to files in the
+// directory and in all of its subdirectories. Directory segments may hold
+// '*' and '?' too, which then match within one name, and a "**" segment
+// matches zero or more directories: "<dir>\*\bin\*.dll" only looks one
+// level down, "<dir>\**\plugins\*.dll" at any depth. A trailing "**" or
+// separator stands for every file below.
+//
+// Patterns starting with '!' exclude the files they match. An exclusion
+// which matches everything below a directory ("!<dir>\data\**") keeps the
+// walk out of that directory altogether.
+//
+// Patterns are compiled into states of a walk over their segments, built
+// the first time a directory needs them. The walk only descends into
+// subdirectories which some pattern can still match below, every subtree
+// is enumerated at most once per scan, and each file is tested once
+// against all patterns which cover its directory.
+//
+// Directory listings are cached across scans and a DirectoryWatcher tells
+// which of them went stale, so a scan only reads directories which changed
+// since the previous one. When nothing changed a scan does no directory I/O.
+class FileScanner
+{
+public:
+	FileScanner() : FileScanner(DirectoryWatcher::create()) {}
+	FileScanner(std::unique_ptr<DirectoryWatcher> watcher) : m_watcher(std::move(watcher)) {}
+	~FileScanner();
+
+	void setPatterns(const std::vector<std::wstring>& patterns);
+
+	void scan(std::vector<std::wstring>& output);
+
+	// Directories read from disk since construction
+	size_t directoryReads() const { return m_directoryReads; }
+
+	// Subdirectories the walks skipped since construction, because no
+	// pattern could match below them or an exclusion covered them
+	size_t directoriesPruned() const { return m_directoriesPruned; }
+
+private:
+	static const size_t NoState = (size_t)-1;
+
+	struct Segment
+	{
+		enum Kind
+		{
+			Literal,
+			Wildcard,
+			AnyDepth,
+		};
+
+		Segment(Kind kind, const std::wstring& name) : kind(kind), name(name) {}
+
+		Kind kind;
+		// As written; case-folded for Literal
+		std::wstring name;
+		PatternSet wildcard;
+	};
+
+	// The last segment matches file names, the others directory names
+	struct Glob
+	{
+		bool exclude;
+		std::vector<Segment> segments;
+	};
+
+	struct Position
+	{
+		uint32_t glob;
+		uint32_t segment;
+
+		bool operator<(const Position& other) const
+		{
+			return glob != other.glob ? glob < other.glob : segment < other.segment;
+		}
+
+		bool operator==(const Position& other) const
+		{
+			return glob == other.glob && segment == other.segment;
+		}
+	};
+
+	// Where the globs stand in one directory: positions are sorted, and a
+	// "**" position comes with the position after it
+	struct State
+	{
+		std::vector<Position> positions;
+		PatternSet includedFiles;
+		PatternSet excludedFiles;
+		// Some glob which includes files is still open
+		bool includes = false;
+		// An exclusion matches every file below
+		bool excludesAll = false;
+		// Subdirectories get the same state whatever their name, once known
+		bool byName = false;
+		size_t anyChild = NoState;
+	};
+
+	// Patterns starting at one directory
+	struct Root
+	{
+		std::filesystem::path path;
+		std::vector<Position> starts;
+	};
+
+	struct WalkRoot
+	{
+		std::filesystem::path path;
+		std::wstring key;
+		size_t state;
+	};
+
+	struct Subdirectory
+	{
+		std::wstring name;
+		std::wstring key;
+	};
+
+	struct Listing
+	{
+		std::filesystem::path path;
+		std::vector<std::wstring> files;
+		std::vector<Subdirectory> directories;
+		bool stale = true;
+		bool watched = false;
+		size_t visited = 0;
+	};
+
+	static std::wstring key(const std::filesystem::path& path);
+	static std::wstring fold(const std::wstring& name);
+
+	void addPattern(const std::wstring& pattern);
+
+	size_t intern(std::vector<Position> positions);
+	std::vector<Position> child(size_t from, const std::wstring& name, const std::wstring& foldedName);
+	size_t enter(size_t from, const std::wstring& name, const std::wstring& key);
+	bool walks(size_t state) const { return m_states[state].includes && !m_states[state].excludesAll; }
+
+	const Listing& list(const std::filesystem::path& directory, const std::wstring& key);
+	void walk(const WalkRoot& top, std::vector<std::wstring>& output);
+
+private:
+	std::vector<Glob> m_globs;
+
+	// Pattern roots by case-folded directory
+	std::map<std::wstring, Root> m_roots;
+
+	// Roots no other walk reaches, each is walked once
+	std::vector<WalkRoot> m_walkRoots;
+
+	// Built as the walks need them, kept until the patterns change
+	std::vector<State> m_states;
+	std::map<std::vector<Position>, size_t> m_stateIds;
+
+	// Cached directory contents by case-folded directory
+	std::map<std::wstring, Listing> m_listings;
+	std::unique_ptr<DirectoryWatcher> m_watcher;
+
+	size_t m_scanCount = 0;
+	size_t m_directoryReads = 0;
+	size_t m_directoriesPruned = 0;
+};
@@ -0,0 +1,325 @@
+#include "stdafx.h"
+#include "LiteralPrefilter.hpp"
+
+#include <algorithm>
+#include <cwctype>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define PREFILTER_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PREFILTER_AVX2_TARGET
+#else
+#define PREFILTER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+static inline wchar_t fold(wchar_t c)
+{
+	return (wchar_t)towupper(c);
+}
+
+static inline bool isWildcard(wchar_t c)
+{
+	return c == L'*' || c == L'?';
+}
+
+static size_t mismatchScalar(const wchar_t* str, const wchar_t* folded, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (str[i] != folded[i] && fold(str[i]) != folded[i]) {
+			return i;
+		}
+	}
+
+	return len;
+}
+
+#ifdef PREFILTER_SSE2
+static inline unsigned lowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned)index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// The vector kernels only fold ASCII. A lane that differs after ASCII
+// folding is re-checked with towupper() before it counts as a mismatch.
+
+static size_t mismatchSse2(const wchar_t* str, const wchar_t* folded, size_t len)
+{
+	const size_t lanes = sizeof(__m128i) / sizeof(wchar_t);
+
+	size_t i = 0;
+	while (i + lanes <= len) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(str + i));
+		__m128i f = _mm_loadu_si128((const __m128i*)(folded + i));
+		__m128i eq;
+
+		if constexpr (sizeof(wchar_t) == 2) {
+			__m128i lower = _mm_and_si128(
+				_mm_cmpgt_epi16(s, _mm_set1_epi16(L'a' - 1)),
+				_mm_cmplt_epi16(s, _mm_set1_epi16(L'z' + 1)));
+			s = _mm_sub_epi16(s, _mm_and_si128(lower, _mm_set1_epi16(0x20)));
+			eq = _mm_cmpeq_epi16(s, f);
+		}
+		else {
+			__m128i lower = _mm_and_si128(
+				_mm_cmpgt_epi32(s, _mm_set1_epi32(L'a' - 1)),
+				_mm_cmplt_epi32(s, _mm_set1_epi32(L'z' + 1)));
+			s = _mm_sub_epi32(s, _mm_and_si128(lower, _mm_set1_epi32(0x20)));
+			eq = _mm_cmpeq_epi32(s, f);
+		}
+
+		unsigned diff = ~(unsigned)_mm_movemask_epi8(eq) & 0xffff;
+
+		if (diff) {
+			size_t j = i + lowestBit(diff) / sizeof(wchar_t);
+
+			if (fold(str[j]) != folded[j]) {
+				return j;
+			}
+
+			i = j + 1;
+			continue;
+		}
+
+		i += lanes;
+	}
+
+	return i + mismatchScalar(str + i, folded + i, len - i);
+}
+
+PREFILTER_AVX2_TARGET
+static size_t mismatchAvx2(const wchar_t* str, const wchar_t* folded, size_t len)
+{
+	const size_t lanes = sizeof(__m256i) / sizeof(wchar_t);
+
+	size_t i = 0;
+	while (i + lanes <= len) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(str + i));
+		__m256i f = _mm256_loadu_si256((const __m256i*)(folded + i));
+		__m256i eq;
+
+		if constexpr (sizeof(wchar_t) == 2) {
+			__m256i lower = _mm256_and_si256(
+				_mm256_cmpgt_epi16(s, _mm256_set1_epi16(L'a' - 1)),
+				_mm256_cmpgt_epi16(_mm256_set1_epi16(L'z' + 1), s));
+			s = _mm256_sub_epi16(s, _mm256_and_si256(lower, _mm256_set1_epi16(0x20)));
+			eq = _mm256_cmpeq_epi16(s, f);
+		}
+		else {
+			__m256i lower = _mm256_and_si256(
+				_mm256_cmpgt_epi32(s, _mm256_set1_epi32(L'a' - 1)),
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(L'z' + 1), s));
+			s = _mm256_sub_epi32(s, _mm256_and_si256(lower, _mm256_set1_epi32(0x20)));
+			eq = _mm256_cmpeq_epi32(s, f);
+		}
+
+		unsigned diff = ~(unsigned)_mm256_movemask_epi8(eq);
+
+		if (diff) {
+			size_t j = i + lowestBit(diff) / sizeof(wchar_t);
+
+			if (fold(str[j]) != folded[j]) {
+				return j;
+			}
+
+			i = j + 1;
+			continue;
+		}
+
+		i += lanes;
+	}
+
+	return i + mismatchSse2(str + i, folded + i, len - i);
+}
+#endif
+
+LiteralPrefilter::Kernel LiteralPrefilter::bestKernel()
+{
+#ifdef PREFILTER_SSE2
+	static const Kernel best = []() {
+		bool avx2 = false;
+
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+
+		if (info[0] >= 7) {
+			__cpuid(info, 1);
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			const bool avx = (info[2] & (1 << 28)) != 0;
+
+			if (osxsave && avx && (_xgetbv(0) & 6) == 6) {
+				__cpuidex(info, 7, 0);
+				avx2 = (info[1] & (1 << 5)) != 0;
+			}
+		}
+#else
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+		return avx2 ? Avx2 : Sse2;
+	}();
+
+	return best;
+#else
+	return Scalar;
+#endif
+}
+
+size_t LiteralPrefilter::mismatch(Kernel kernel, const wchar_t* str, const wchar_t* folded, size_t len)
+{
+#ifdef PREFILTER_SSE2
+	switch (kernel) {
+	case Avx2:
+		return mismatchAvx2(str, folded, len);
+	case Sse2:
+		return mismatchSse2(str, folded, len);
+	default:
+		break;
+	}
+#endif
+
+	return mismatchScalar(str, folded, len);
+}
+
+void LiteralPrefilter::build(const std::vector<std::wstring>& patterns)
+{
+	m_empty = patterns.empty();
+	m_common.clear();
+	m_groups.clear();
+
+	std::vector<std::wstring> prefixes;
+
+	for (auto& pattern : patterns) {
+		size_t first = 0;
+		while (first < pattern.size() && !isWildcard(pattern[first])) {
+			++first;
+		}
+
+		size_t last = pattern.size();
+		while (last > first && !isWildcard(pattern[last - 1])) {
+			--last;
+		}
+
+		Anchor anchor;
+		anchor.exact = first == pattern.size();
+		anchor.minLength = 0;
+
+		size_t stars = 0;
+		bool wasStar = false;
+		for (wchar_t ch : pattern) {
+			if (ch == L'*') {
+				if (!wasStar) {
+					++stars;
+				}
+			}
+			else {
+				++anchor.minLength;
+			}
+
+			wasStar = ch == L'*';
+		}
+
+		std::wstring prefix;
+		for (size_t i = 0; i < first; ++i) {
+			prefix.push_back(fold(pattern[i]));
+		}
+
+		if (!anchor.exact) {
+			for (size_t i = last; i < pattern.size(); ++i) {
+				anchor.suffix.push_back(fold(pattern[i]));
+			}
+		}
+
+		// prefix**suffix: anchors are the whole pattern. A single star stops
+		// at separators, which only the NFA can tell.
+		const bool onlyStars = std::all_of(
+			pattern.begin() + first,
+			pattern.begin() + last,
+			[](wchar_t ch) { return ch == L'*'; });
+		anchor.complete = anchor.exact || (stars == 1 && onlyStars && last - first >= 2);
+
+		auto group = std::find_if(m_groups.begin(), m_groups.end(),
+			[&prefix](const Group& g) { return g.prefix == prefix; });
+
+		if (group == m_groups.end()) {
+			m_groups.emplace_back();
+			group = m_groups.end() - 1;
+			group->prefix = prefix;
+		}
+
+		group->anchors.emplace_back(anchor);
+	}
+
+	if (m_groups.empty()) {
+		return;
+	}
+
+	// Hoist the longest prefix shared by all groups
+	m_common = m_groups[0].prefix;
+	for (auto& group : m_groups) {
+		size_t n = 0;
+		while (n < m_common.size() && n < group.prefix.size() && m_common[n] == group.prefix[n]) {
+			++n;
+		}
+
+		m_common.resize(n);
+	}
+
+	for (auto& group : m_groups) {
+		group.prefix.erase(0, m_common.size());
+	}
+}
+
+LiteralPrefilter::Result LiteralPrefilter::test(const wchar_t* str, size_t len) const
+{
+	if (m_empty) {
+		return Reject;
+	}
+
+	const size_t common = m_common.size();
+
+	if (len < common || mismatch(m_kernel, str, m_common.c_str(), common) != common) {
+		return Reject;
+	}
+
+	bool undecided = false;
+
+	for (auto& group : m_groups) {
+		const size_t prefixLen = common + group.prefix.size();
+
+		if (len < prefixLen ||
+			mismatch(m_kernel, str + common, group.prefix.c_str(), group.prefix.size()) != group.prefix.size()) {
+			continue;
+		}
+
+		for (auto& anchor : group.anchors) {
+			if (len < anchor.minLength || (anchor.exact && len != anchor.minLength)) {
+				continue;
+			}
+
+			const size_t suffixLen = anchor.suffix.size();
+
+			if (mismatch(m_kernel, str + len - suffixLen, anchor.suffix.c_str(), suffixLen) != suffixLen) {
+				continue;
+			}
+
+			if (anchor.complete) {
+				return Accept;
+			}
+
+			undecided = true;
+		}
+	}
+
+	return undecided ? Undecided : Reject;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Cheap first stage in front of the PatternSet NFA.
+//
+// Almost every pattern is a literal directory prefix plus a literal
+// extension suffix ("C:\Program Files\X\bin\*.dll"), and almost every
+// candidate path fails on its first few characters. The literal anchors of
+// all patterns are pulled out once and compared against the path with
+// vectorized case-insensitive compares, so most paths are rejected without
+// running the NFA at all.
+class LiteralPrefilter
+{
+public:
+	enum Kernel
+	{
+		Scalar,
+		Sse2,
+		Avx2
+	};
+
+	enum Result
+	{
+		Reject,    // no pattern can match
+		Accept,    // a pattern matches, no need to run the NFA
+		Undecided  // anchors match, the NFA has to decide
+	};
+
+	LiteralPrefilter() : m_kernel(bestKernel()) {}
+
+	void build(const std::vector<std::wstring>& patterns);
+
+	Result test(const wchar_t* str, size_t len) const;
+
+	Kernel kernel() const { return m_kernel; }
+	void setKernel(Kernel kernel) { m_kernel = kernel; }
+
+	// Best kernel supported by this CPU
+	static Kernel bestKernel();
+
+	// Length of the common prefix of str and folded, where folded is
+	// already upper-cased. Case-insensitive, same folding as PatternSet.
+	static size_t mismatch(Kernel kernel, const wchar_t* str, const wchar_t* folded, size_t len);
+
+private:
+	struct Anchor
+	{
+		std::wstring suffix;
+		size_t minLength;
+		bool exact;    // pattern has no wildcards at all
+		bool complete; // prefix and suffix match means the pattern matches
+	};
+
+	struct Group
+	{
+		std::wstring prefix; // after m_common
+		std::vector<Anchor> anchors;
+	};
+
+	Kernel m_kernel;
+	bool m_empty = true;
+
+	// Common prefix of every pattern, checked first
+	std::wstring m_common;
+	std::vector<Group> m_groups;
+};
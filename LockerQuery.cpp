@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "LockerQuery.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <RestartManager.h>
+
+#pragma comment(lib, "Rstrtmgr.lib")
+#endif
+
+#ifdef _WIN32
+
+static ULONGLONG toULongLong(const FILETIME& ft)
+{
+	return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+class Win32RestartManager : public RestartManagerBackend
+{
+public:
+	bool query(const std::wstring* files, size_t count, std::vector<ProcessKey>& output) override
+	{
+		bool returnVal = false;
+
+		DWORD dwSession;
+		WCHAR szSessionKey[CCH_RM_SESSION_KEY + 1] = { 0 };
+		DWORD dwError = RmStartSession(&dwSession, 0, szSessionKey);
+
+		if (dwError != ERROR_SUCCESS)
+			return false;
+
+		std::vector<LPCWSTR> filesArray;
+		for (size_t i = 0; i < count; ++i) {
+			filesArray.push_back(files[i].c_str());
+		}
+
+		dwError = RmRegisterResources(dwSession, (UINT)filesArray.size(), filesArray.data(),
+			0, NULL, 0, NULL);
+
+		if (dwError == ERROR_SUCCESS) {
+			DWORD dwReason;
+			UINT nProcInfoNeeded = 0;
+			UINT nProcInfo = 0;
+
+			dwError = RmGetList(dwSession, &nProcInfoNeeded, &nProcInfo, nullptr, &dwReason);
+
+			if (dwError == ERROR_SUCCESS) {
+				returnVal = true;
+			}
+			else if (dwError == ERROR_MORE_DATA) {
+				nProcInfo = nProcInfoNeeded;
+
+				std::vector<RM_PROCESS_INFO> result;
+				result.resize(nProcInfo);
+
+				dwError = RmGetList(dwSession, &nProcInfoNeeded,
+					&nProcInfo, result.data(), &dwReason);
+
+				returnVal = dwError == ERROR_SUCCESS;
+
+				for (UINT i = 0; returnVal && i < nProcInfo; ++i) {
+					output.push_back({
+						result[i].Process.dwProcessId,
+						toULongLong(result[i].Process.ProcessStartTime) });
+				}
+			}
+		}
+
+		RmEndSession(dwSession);
+
+		return returnVal;
+	}
+};
+
+#endif
+
+// Fallback: there is no Restart Manager
+class NullRestartManager : public RestartManagerBackend
+{
+public:
+	bool query(const std::wstring*, size_t, std::vector<ProcessKey>&) override
+	{
+		return false;
+	}
+};
+
+std::unique_ptr<RestartManagerBackend> RestartManagerBackend::create()
+{
+#ifdef _WIN32
+	return std::make_unique<Win32RestartManager>();
+#else
+	return std::make_unique<NullRestartManager>();
+#endif
+}
+
+void FakeRestartManager::setLockers(const std::wstring& file, const std::vector<ProcessKey>& keys)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_lockers[file] = keys;
+}
+
+bool FakeRestartManager::query(const std::wstring* files, size_t count, std::vector<ProcessKey>& output)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		++m_sessions;
+
+		for (size_t i = 0; i < count; ++i) {
+			auto it = m_lockers.find(files[i]);
+
+			if (it != m_lockers.end()) {
+				output.insert(output.end(), it->second.begin(), it->second.end());
+			}
+		}
+	}
+
+	std::this_thread::sleep_for(m_sessionCost + m_fileCost * (long long)count);
+
+	return true;
+}
+
+LockerQuery::LockerQuery(std::unique_ptr<RestartManagerBackend> backend, size_t shardSize, size_t workers) :
+	m_backend(std::move(backend)),
+	m_shardSize(shardSize ? shardSize : 1)
+{
+	for (size_t i = 0; i < workers; ++i) {
+		m_workers.emplace_back(worker, this);
+	}
+}
+
+LockerQuery::~LockerQuery()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		m_stopping = true;
+		m_work.notify_all();
+	}
+
+	for (auto& thread : m_workers) {
+		thread.join();
+	}
+}
+
+bool LockerQuery::runShard(size_t shard)
+{
+	const size_t begin = shard * m_shardSize;
+	const size_t count = (std::min)(m_shardSize, m_files->size() - begin);
+
+	MetricsTimer timer(PhaseRestartManager);
+	Metrics::shared().add(CounterFilesRegistered, count);
+
+	return m_backend->query(m_files->data() + begin, count, m_results[shard]);
+}
+
+void LockerQuery::worker(LockerQuery* self)
+{
+	Trace::nameThread("restart-manager");
+
+	std::unique_lock<std::mutex> lock(self->m_mutex);
+
+	for (;;) {
+		self->m_work.wait(lock, [self] {
+			return self->m_stopping || self->m_nextShard < self->m_results.size();
+		});
+
+		if (self->m_stopping) {
+			return;
+		}
+
+		const size_t shard = self->m_nextShard++;
+
+		lock.unlock();
+		const bool result = self->runShard(shard);
+		lock.lock();
+
+		if (!result) {
+			self->m_failed = true;
+		}
+
+		if (--self->m_pendingShards == 0) {
+			self->m_done.notify_all();
+		}
+	}
+}
+
+bool LockerQuery::query(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output)
+{
+	std::lock_guard<std::mutex> queryGuard(m_queryMutex);
+
+	const size_t shardCount = (files.size() + m_shardSize - 1) / m_shardSize;
+
+	if (!shardCount) {
+		return true;
+	}
+
+	bool failed = false;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		m_files = &files;
+		m_results.assign(shardCount, std::vector<ProcessKey>());
+		m_failed = false;
+
+		if (shardCount == 1 || m_workers.empty()) {
+			// Not worth a round trip through the pool
+			m_nextShard = shardCount;
+
+			lock.unlock();
+
+			for (size_t shard = 0; shard < shardCount && !failed; ++shard) {
+				failed = !runShard(shard);
+			}
+		}
+		else {
+			m_nextShard = 0;
+			m_pendingShards = shardCount;
+			m_work.notify_all();
+
+			m_done.wait(lock, [this] { return m_pendingShards == 0; });
+
+			failed = m_failed;
+		}
+	}
+
+	if (failed) {
+		return false;
+	}
+
+	// A process locking files in several shards is reported once
+	std::vector<ProcessKey> merged;
+
+	for (auto& result : m_results) {
+		merged.insert(merged.end(), result.begin(), result.end());
+	}
+
+	std::sort(merged.begin(), merged.end());
+	merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+
+	output.insert(output.end(), merged.begin(), merged.end());
+
+	return true;
+}
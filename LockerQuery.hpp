@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One Restart Manager session: registers files and lists the processes
+// which lock them. Implementations must allow concurrent calls, each call
+// being a session of its own.
+class RestartManagerBackend
+{
+public:
+	virtual ~RestartManagerBackend() {}
+
+	virtual bool query(const std::wstring* files, size_t count, std::vector<ProcessKey>& output) = 0;
+
+	// Restart Manager on Windows. Elsewhere there is none and every query
+	// fails.
+	static std::unique_ptr<RestartManagerBackend> create();
+};
+
+// Restart Manager stand-in with a latency model: each session costs a
+// fixed amount plus an amount per registered file.
+class FakeRestartManager : public RestartManagerBackend
+{
+public:
+	FakeRestartManager(std::chrono::microseconds sessionCost, std::chrono::microseconds fileCost) :
+		m_sessionCost(sessionCost),
+		m_fileCost(fileCost)
+	{
+	}
+
+	void setLockers(const std::wstring& file, const std::vector<ProcessKey>& keys);
+
+	bool query(const std::wstring* files, size_t count, std::vector<ProcessKey>& output) override;
+
+	// Sessions started so far
+	size_t sessions() const { return m_sessions; }
+
+private:
+	std::chrono::microseconds m_sessionCost;
+	std::chrono::microseconds m_fileCost;
+
+	std::mutex m_mutex;
+	std::map<std::wstring, std::vector<ProcessKey>> m_lockers;
+	size_t m_sessions = 0;
+};
+
+// Finds the lockers of a large file set by splitting it into shards which
+// are queried on parallel sessions by a pool of workers.
+//
+// Restart Manager gets slower the more resources one session has to check,
+// an installation with thousands of DLLs used to take tens of seconds per
+// poll in a single session. Results are merged and deduplicated.
+class LockerQuery
+{
+public:
+	static const size_t DefaultShardSize = 256;
+	static const size_t DefaultWorkers = 4;
+
+	LockerQuery(std::unique_ptr<RestartManagerBackend> backend,
+		size_t shardSize = DefaultShardSize, size_t workers = DefaultWorkers);
+	~LockerQuery();
+
+	// Fails if any shard fails
+	bool query(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output);
+
+private:
+	static void worker(LockerQuery* self);
+
+	bool runShard(size_t shard);
+
+private:
+	std::unique_ptr<RestartManagerBackend> m_backend;
+	size_t m_shardSize;
+
+	// Serializes query()
+	std::mutex m_queryMutex;
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_work;
+	std::condition_variable m_done;
+	bool m_stopping = false;
+
+	// The batch being worked on
+	const std::vector<std::wstring>* m_files = nullptr;
+	std::vector<std::vector<ProcessKey>> m_results;
+	size_t m_nextShard = 0;
+	size_t m_pendingShards = 0;
+	bool m_failed = false;
+};
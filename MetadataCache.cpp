@@ -0,0 +1,374 @@
+#include "stdafx.h"
+#include "MetadataCache.hpp"
+
+#include <vector>
+
+#ifdef _WIN32
+#pragma comment(lib, "Version.lib")
+#elif defined(__linux__)
+#include <sys/stat.h>
+#endif
+
+ProcessMetadata::~ProcessMetadata()
+{
+#ifdef _WIN32
+	if (icon) {
+		DestroyIcon(icon);
+	}
+#endif
+}
+
+static std::wstring fileName(const wchar_t* path, size_t len)
+{
+	size_t begin = len;
+
+	while (begin > 0 && path[begin - 1] != L'\\' && path[begin - 1] != L'/') {
+		--begin;
+	}
+
+	return std::wstring(path + begin, len - begin);
+}
+
+#ifdef _WIN32
+
+static ULONGLONG toULongLong(const FILETIME& ft)
+{
+	return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+// Color and mask bitmaps of a 32x32 icon
+static const size_t IconBytes = 32 * 32 * 4 + 32 * 32 / 8;
+
+// Icon and file description from the executable's resources
+class Win32MetadataLoader : public MetadataLoader
+{
+public:
+	bool identity(PathId path, FileIdentity& identity) override
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+
+		if (!GetFileAttributesExW(PathStore::shared().get(path), GetFileExInfoStandard, &data)) {
+			return false;
+		}
+
+		identity.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		identity.modified = toULongLong(data.ftLastWriteTime);
+
+		return true;
+	}
+
+	bool load(PathId path, ProcessMetadata& metadata) override
+	{
+		const PathStore& paths = PathStore::shared();
+
+		metadata.icon = ExtractIconW(NULL, paths.get(path), 0);
+
+		// Not an executable
+		if (metadata.icon == (HICON)1) {
+			metadata.icon = NULL;
+		}
+
+		if (!description(paths.get(path), metadata.displayName)) {
+			metadata.displayName = fileName(paths.get(path), paths.length(path));
+		}
+
+		metadata.bytes = sizeof(ProcessMetadata) +
+			metadata.displayName.size() * sizeof(wchar_t) +
+			(metadata.icon ? IconBytes : 0);
+
+		return true;
+	}
+
+private:
+	static bool description(const wchar_t* path, std::wstring& output)
+	{
+		DWORD handle = 0;
+		DWORD size = GetFileVersionInfoSizeW(path, &handle);
+
+		if (!size) {
+			return false;
+		}
+
+		std::vector<BYTE> info(size);
+
+		if (!GetFileVersionInfoW(path, 0, size, info.data())) {
+			return false;
+		}
+
+		struct Translation
+		{
+			WORD language;
+			WORD codePage;
+		};
+
+		Translation* translations = nullptr;
+		UINT len = 0;
+
+		if (!VerQueryValueW(info.data(), L"\\VarFileInfo\\Translation", (LPVOID*)&translations, &len) ||
+			len < sizeof(Translation)) {
+			return false;
+		}
+
+		wchar_t query[64];
+		swprintf_s(query, L"\\StringFileInfo\\%04x%04x\\FileDescription",
+			translations[0].language, translations[0].codePage);
+
+		wchar_t* value = nullptr;
+
+		if (!VerQueryValueW(info.data(), query, (LPVOID*)&value, &len) || len <= 1) {
+			return false;
+		}
+
+		output.assign(value, wcsnlen(value, len));
+
+		return !output.empty();
+	}
+};
+
+#elif defined(__linux__)
+
+// No icons, the file name is shown
+class PosixMetadataLoader : public MetadataLoader
+{
+public:
+	bool identity(PathId path, FileIdentity& identity) override
+	{
+		struct stat st;
+
+		if (stat(encodeUtf8(path).c_str(), &st) < 0) {
+			return false;
+		}
+
+		identity.size = (uint64_t)st.st_size;
+		identity.modified = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+		return true;
+	}
+
+	bool load(PathId path, ProcessMetadata& metadata) override
+	{
+		const PathStore& paths = PathStore::shared();
+
+		metadata.displayName = fileName(paths.get(path), paths.length(path));
+		metadata.bytes = sizeof(ProcessMetadata) + metadata.displayName.size() * sizeof(wchar_t);
+
+		return true;
+	}
+
+private:
+	// Inverse of the decoding done by the process source
+	static std::string encodeUtf8(PathId path)
+	{
+		const PathStore& paths = PathStore::shared();
+		const wchar_t* str = paths.get(path);
+		const size_t len = paths.length(path);
+
+		std::string output;
+		output.reserve(len);
+
+		for (size_t i = 0; i < len; ++i) {
+			uint32_t cp = (uint32_t)str[i];
+
+			if (cp < 0x80) {
+				output += (char)cp;
+			}
+			else if (cp < 0x800) {
+				output += (char)(0xC0 | (cp >> 6));
+				output += (char)(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				output += (char)(0xE0 | (cp >> 12));
+				output += (char)(0x80 | ((cp >> 6) & 0x3F));
+				output += (char)(0x80 | (cp & 0x3F));
+			}
+			else {
+				output += (char)(0xF0 | (cp >> 18));
+				output += (char)(0x80 | ((cp >> 12) & 0x3F));
+				output += (char)(0x80 | ((cp >> 6) & 0x3F));
+				output += (char)(0x80 | (cp & 0x3F));
+			}
+		}
+
+		return output;
+	}
+};
+
+#endif
+
+// Fallback: nothing is known about any file
+class NullMetadataLoader : public MetadataLoader
+{
+public:
+	bool identity(PathId, FileIdentity&) override { return false; }
+	bool load(PathId, ProcessMetadata&) override { return false; }
+};
+
+std::unique_ptr<MetadataLoader> MetadataLoader::create()
+{
+#ifdef _WIN32
+	return std::make_unique<Win32MetadataLoader>();
+#elif defined(__linux__)
+	return std::make_unique<PosixMetadataLoader>();
+#else
+	return std::make_unique<NullMetadataLoader>();
+#endif
+}
+
+void FakeMetadataLoader::touch(PathId path)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_versions[path];
+}
+
+bool FakeMetadataLoader::identity(PathId path, FileIdentity& identity)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	identity.size = m_bytesPerEntry;
+	identity.modified = m_versions[path];
+
+	return path != InvalidPathId;
+}
+
+bool FakeMetadataLoader::load(PathId path, ProcessMetadata& metadata)
+{
+	const PathStore& paths = PathStore::shared();
+
+	metadata.displayName = fileName(paths.get(path), paths.length(path));
+	metadata.bytes = m_bytesPerEntry;
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_loads;
+
+	return path != InvalidPathId;
+}
+
+MetadataCache::MetadataCache(std::unique_ptr<MetadataLoader> loader, size_t budget) :
+	m_loader(std::move(loader)),
+	m_budget(budget)
+{
+}
+
+MetadataCache& MetadataCache::shared()
+{
+	static MetadataCache* cache = new MetadataCache(MetadataLoader::create());
+
+	return *cache;
+}
+
+ProcessMetadataPtr MetadataCache::acquire(PathId path)
+{
+	if (path == InvalidPathId) {
+		return nullptr;
+	}
+
+	// Checked on every acquire: an executable replaced by an update has
+	// a new icon. Only new processes get here, and a stat is far cheaper
+	// than extracting an icon.
+	FileIdentity identity;
+
+	if (!m_loader->identity(path, identity)) {
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		auto it = m_entries.find(path);
+
+		if (it != m_entries.end() && it->second.identity == identity) {
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+			++m_hits;
+
+			return it->second.metadata;
+		}
+
+		++m_misses;
+	}
+
+	// Loaded without the lock, extracting an icon takes a while
+	auto metadata = std::make_shared<ProcessMetadata>();
+
+	if (!m_loader->load(path, *metadata)) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	auto it = m_entries.find(path);
+
+	if (it != m_entries.end()) {
+		// Loaded by another thread meanwhile
+		if (it->second.identity == identity) {
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+
+			return it->second.metadata;
+		}
+
+		// An older version of the file, its processes keep their copy
+		m_bytes -= it->second.metadata->bytes;
+		m_lru.erase(it->second.lru);
+		m_entries.erase(it);
+	}
+
+	m_lru.push_front(path);
+
+	Entry& entry = m_entries[path];
+	entry.identity = identity;
+	entry.metadata = metadata;
+	entry.lru = m_lru.begin();
+
+	m_bytes += metadata->bytes;
+
+	evict();
+
+	return metadata;
+}
+
+void MetadataCache::evict()
+{
+	// Entries still used by a process stay, whatever the budget
+	for (auto it = m_lru.end(); m_bytes > m_budget && it != m_lru.begin(); ) {
+		--it;
+
+		auto entry = m_entries.find(*it);
+
+		if (entry->second.metadata.use_count() > 1) {
+			continue;
+		}
+
+		m_bytes -= entry->second.metadata->bytes;
+		m_entries.erase(entry);
+		it = m_lru.erase(it);
+	}
+}
+
+size_t MetadataCache::count() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_entries.size();
+}
+
+size_t MetadataCache::bytes() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_bytes;
+}
+
+size_t MetadataCache::hits() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_hits;
+}
+
+size_t MetadataCache::misses() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_misses;
+}
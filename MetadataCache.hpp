@@ -0,0 +1,135 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "PathStore.hpp"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Identifies one version of an executable: a file replaced by an update
+// gets a new entry
+struct FileIdentity
+{
+	uint64_t size = 0;
+	uint64_t modified = 0;
+
+	bool operator==(const FileIdentity& other) const { return size == other.size && modified == other.modified; }
+};
+
+// What the dialog shows for an executable, shared by all of its processes
+struct ProcessMetadata
+{
+	ProcessMetadata() {}
+	ProcessMetadata(const ProcessMetadata&) = delete;
+	ProcessMetadata& operator=(const ProcessMetadata&) = delete;
+	~ProcessMetadata();
+
+	// File description from the version resource, else the file name
+	std::wstring displayName;
+
+#ifdef _WIN32
+	HICON icon = NULL;
+#endif
+
+	// Approximate memory held, for the cache budget
+	size_t bytes = 0;
+};
+
+typedef std::shared_ptr<const ProcessMetadata> ProcessMetadataPtr;
+
+// Reads metadata from an executable
+class MetadataLoader
+{
+public:
+	virtual ~MetadataLoader() {}
+
+	// Fails if the file is gone
+	virtual bool identity(PathId path, FileIdentity& identity) = 0;
+	virtual bool load(PathId path, ProcessMetadata& metadata) = 0;
+
+	// Icon and version resource on Windows, file name elsewhere
+	static std::unique_ptr<MetadataLoader> create();
+};
+
+// Loader with made up metadata which counts how often it is asked
+class FakeMetadataLoader : public MetadataLoader
+{
+public:
+	FakeMetadataLoader(size_t bytesPerEntry = 4096) : m_bytesPerEntry(bytesPerEntry) {}
+
+	// Makes identity() report a new version of the file
+	void touch(PathId path);
+
+	bool identity(PathId path, FileIdentity& identity) override;
+	bool load(PathId path, ProcessMetadata& metadata) override;
+
+	size_t loads() const { return m_loads; }
+
+private:
+	size_t m_bytesPerEntry;
+
+	std::mutex m_mutex;
+	std::map<PathId, uint64_t> m_versions;
+	size_t m_loads = 0;
+};
+
+// Metadata by executable path and file identity.
+//
+// Ten chrome.exe processes share one entry, so the icon is extracted once
+// instead of once per process. Entries are reference counted by the
+// processes using them; entries no process uses are kept for reuse and
+// evicted least recently used first once the cache holds more than its
+// byte budget.
+class MetadataCache
+{
+public:
+	static const size_t DefaultBudget = 4 * 1024 * 1024;
+
+	MetadataCache(std::unique_ptr<MetadataLoader> loader, size_t budget = DefaultBudget);
+	MetadataCache(const MetadataCache&) = delete;
+	MetadataCache& operator=(const MetadataCache&) = delete;
+
+	// Cache shared by every Process
+	static MetadataCache& shared();
+
+	// Null if the file cannot be read
+	ProcessMetadataPtr acquire(PathId path);
+
+	// Entries and bytes held, including entries in use
+	size_t count() const;
+	size_t bytes() const;
+
+	size_t hits() const;
+	size_t misses() const;
+
+private:
+	struct Entry
+	{
+		FileIdentity identity;
+		ProcessMetadataPtr metadata;
+		std::list<PathId>::iterator lru;
+	};
+
+	void evict();
+
+private:
+	std::unique_ptr<MetadataLoader> m_loader;
+	size_t m_budget;
+
+	mutable std::mutex m_mutex;
+	std::map<PathId, Entry> m_entries;
+
+	// Most recently used first
+	std::list<PathId> m_lru;
+
+	size_t m_bytes = 0;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+};
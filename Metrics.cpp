@@ -0,0 +1,208 @@
+#include "stdafx.h"
+#include "Metrics.hpp"
+#include "TextFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+Metrics& Metrics::shared()
+{
+	static Metrics* metrics = new Metrics();
+
+	return *metrics;
+}
+
+const char* Metrics::name(MetricsPhase phase)
+{
+	static const char* const names[MetricsPhaseCount] = {
+		"update",
+		"snapshot",
+		"image_path",
+		"match",
+		"file_scan",
+		"restart_manager",
+		"open_files",
+		"modules",
+		"commit",
+		"lock_wait",
+	};
+
+	return names[phase];
+}
+
+const char* Metrics::name(MetricsCounter counter)
+{
+	static const char* const names[MetricsCounterCount] = {
+		"scans",
+		"scan_failures",
+		"processes_opened",
+		"files_registered",
+		"allocations",
+		"lock_waits",
+	};
+
+	return names[counter];
+}
+
+uint64_t Metrics::Histogram::percentile(double p) const
+{
+	if (!count) {
+		return 0;
+	}
+
+	const uint64_t rank = (uint64_t)(p * (double)(count - 1)) + 1;
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < BucketCount; ++i) {
+		seen += buckets[i];
+
+		if (seen >= rank) {
+			return (std::min)(i ? (uint64_t)1 << i : 1, maxMicroseconds);
+		}
+	}
+
+	return maxMicroseconds;
+}
+
+void Metrics::record(MetricsPhase phase, std::chrono::nanoseconds duration)
+{
+	const uint64_t us = duration.count() > 0 ? (uint64_t)duration.count() / 1000 : 0;
+
+	size_t bucket = 0;
+
+	for (uint64_t v = us; v && bucket < BucketCount - 1; v >>= 1) {
+		++bucket;
+	}
+
+	Phase& p = m_phases[phase];
+
+	p.totalMicroseconds.fetch_add(us, std::memory_order_relaxed);
+	p.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = p.maxMicroseconds.load(std::memory_order_relaxed);
+
+	while (us > max && !p.maxMicroseconds.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+	}
+}
+
+Metrics::Histogram Metrics::histogram(MetricsPhase phase) const
+{
+	const Phase& p = m_phases[phase];
+	Histogram output;
+
+	output.totalMicroseconds = p.totalMicroseconds.load(std::memory_order_relaxed);
+	output.maxMicroseconds = p.maxMicroseconds.load(std::memory_order_relaxed);
+
+	// Percentiles always add up to the count
+	for (size_t i = 0; i < BucketCount; ++i) {
+		output.buckets[i] = p.buckets[i].load(std::memory_order_relaxed);
+		output.count += output.buckets[i];
+	}
+
+	return output;
+}
+
+uint64_t Metrics::counter(MetricsCounter counter) const
+{
+	return m_counters[counter].load(std::memory_order_relaxed);
+}
+
+void Metrics::reset()
+{
+	for (auto& p : m_phases) {
+		p.totalMicroseconds = 0;
+		p.maxMicroseconds = 0;
+
+		for (auto& bucket : p.buckets) {
+			bucket = 0;
+		}
+	}
+
+	for (auto& counter : m_counters) {
+		counter = 0;
+	}
+}
+
+std::string Metrics::summary() const
+{
+	std::string output;
+	char buf[128];
+
+	for (size_t i = 0; i < MetricsCounterCount; ++i) {
+		snprintf(buf, sizeof(buf), "%s%s=%llu", output.empty() ? "" : " ",
+			name((MetricsCounter)i), (unsigned long long)counter((MetricsCounter)i));
+		output += buf;
+	}
+
+	for (size_t i = 0; i < MetricsPhaseCount; ++i) {
+		const Histogram h = histogram((MetricsPhase)i);
+
+		if (!h.count) {
+			continue;
+		}
+
+		snprintf(buf, sizeof(buf), " %s=%llu/%lluus/%lluus", name((MetricsPhase)i),
+			(unsigned long long)h.count, (unsigned long long)h.percentile(0.50),
+			(unsigned long long)h.percentile(0.99));
+		output += buf;
+	}
+
+	return output;
+}
+
+std::string Metrics::report() const
+{
+	std::string output;
+	char buf[256];
+
+	output += "phase count total_us mean_us p50_us p90_us p99_us max_us buckets\n";
+
+	for (size_t i = 0; i < MetricsPhaseCount; ++i) {
+		const Histogram h = histogram((MetricsPhase)i);
+
+		snprintf(buf, sizeof(buf), "%s %llu %llu %llu %llu %llu %llu %llu", name((MetricsPhase)i),
+			(unsigned long long)h.count, (unsigned long long)h.totalMicroseconds,
+			(unsigned long long)(h.count ? h.totalMicroseconds / h.count : 0),
+			(unsigned long long)h.percentile(0.50), (unsigned long long)h.percentile(0.90),
+			(unsigned long long)h.percentile(0.99), (unsigned long long)h.maxMicroseconds);
+		output += buf;
+
+		// Bucket index:count for the non-empty buckets only
+		for (size_t b = 0; b < BucketCount; ++b) {
+			if (h.buckets[b]) {
+				snprintf(buf, sizeof(buf), " %zu:%llu", b, (unsigned long long)h.buckets[b]);
+				output += buf;
+			}
+		}
+
+		output += "\n";
+	}
+
+	output += "\n";
+
+	for (size_t i = 0; i < MetricsCounterCount; ++i) {
+		snprintf(buf, sizeof(buf), "%s %llu\n", name((MetricsCounter)i), (unsigned long long)counter((MetricsCounter)i));
+		output += buf;
+	}
+
+	return output;
+}
+
+bool Metrics::dump(const std::wstring& path) const
+{
+	return writeTextFile(path, report());
+}
+
+std::unique_lock<std::mutex> Metrics::lock(std::mutex& mutex)
+{
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+
+	if (!lock.owns_lock()) {
+		MetricsTimer timer(PhaseLockWait);
+
+		shared().add(CounterLockWaits);
+		lock.lock();
+	}
+
+	return lock;
+}
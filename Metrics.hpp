@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "Trace.hpp"
+
+// Timed sections of a scan
+enum MetricsPhase
+{
+	// update() as a whole
+	PhaseUpdate,
+	// Process table enumeration
+	PhaseSnapshot,
+	// Opening a process and querying its image path
+	PhaseImagePath,
+	// One path against the pattern set
+	PhaseMatch,
+	// Directory walk for RestartManager mode
+	PhaseFileScan,
+	// One Restart Manager session, per shard
+	PhaseRestartManager,
+	// System handle table walk for OpenFiles mode
+	PhaseOpenFiles,
+	// Reading one process's module list
+	PhaseModules,
+	// Merging a scan into the published list
+	PhaseCommit,
+	// Time spent blocked on an engine lock, only when it was contended
+	PhaseLockWait,
+
+	MetricsPhaseCount
+};
+
+enum MetricsCounter
+{
+	CounterScans,
+	CounterScanFailures,
+	// Processes opened for their image path or modules
+	CounterProcessesOpened,
+	// Files passed to Restart Manager
+	CounterFilesRegistered,
+	// Objects the engine allocates as it scans: list items, snapshots and
+	// their change records
+	CounterAllocations,
+	CounterLockWaits,
+
+	MetricsCounterCount
+};
+
+// Process-wide counters and per-phase latency histograms.
+//
+// Cheap enough to stay on in release builds: a sample is two clock reads
+// and a few relaxed atomic increments, with no locks and no allocation.
+// Histograms have fixed power-of-two buckets in microseconds, so
+// percentiles are accurate to within a factor of two.
+class Metrics
+{
+public:
+	// Bucket 0 holds samples under 1 us, bucket i samples of 2^(i-1) to
+	// 2^i us
+	static const size_t BucketCount = 32;
+
+	struct Histogram
+	{
+		uint64_t count = 0;
+		uint64_t totalMicroseconds = 0;
+		uint64_t maxMicroseconds = 0;
+		uint64_t buckets[BucketCount] = {};
+
+		// Upper bound of the bucket holding the p-th sample, in us, at most
+		// the largest sample
+		uint64_t percentile(double p) const;
+	};
+
+	Metrics() {}
+	Metrics(const Metrics&) = delete;
+	Metrics& operator=(const Metrics&) = delete;
+
+	static Metrics& shared();
+
+	static const char* name(MetricsPhase phase);
+	static const char* name(MetricsCounter counter);
+
+	void record(MetricsPhase phase, std::chrono::nanoseconds duration);
+	void add(MetricsCounter counter, uint64_t value = 1)
+	{
+		m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	// Consistent per value, not across values
+	Histogram histogram(MetricsPhase phase) const;
+	uint64_t counter(MetricsCounter counter) const;
+
+	void reset();
+
+	// One line: counters, then count and p50/p99 of the phases which ran
+	std::string summary() const;
+
+	// One line per phase with its histogram, then the counters
+	std::string report() const;
+	bool dump(const std::wstring& path) const;
+
+	// Locks mutex, counting and timing the wait if another thread holds it
+	static std::unique_lock<std::mutex> lock(std::mutex& mutex);
+
+private:
+	// The count is the buckets' sum
+	struct Phase
+	{
+		std::atomic<uint64_t> totalMicroseconds{ 0 };
+		std::atomic<uint64_t> maxMicroseconds{ 0 };
+		std::atomic<uint64_t> buckets[BucketCount] = {};
+	};
+
+private:
+	Phase m_phases[MetricsPhaseCount];
+	std::atomic<uint64_t> m_counters[MetricsCounterCount] = {};
+};
+
+// Records the time from construction to destruction into a phase of the
+// shared Metrics, and as a span of the trace when tracing is on
+class MetricsTimer
+{
+public:
+	MetricsTimer(MetricsPhase phase) :
+		m_phase(phase),
+		m_start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~MetricsTimer()
+	{
+		const auto end = std::chrono::steady_clock::now();
+
+		Metrics::shared().record(m_phase, end - m_start);
+
+		if (Trace::enabled()) {
+			Trace::shared().complete(Metrics::name(m_phase), m_phase == PhaseLockWait ? "lock" : "scan", m_start, end);
+		}
+	}
+
+	MetricsTimer(const MetricsTimer&) = delete;
+	MetricsTimer& operator=(const MetricsTimer&) = delete;
+
+private:
+	MetricsPhase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
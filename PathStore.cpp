@@ -0,0 +1,135 @@
+#include "stdafx.h"
+#include "PathStore.hpp"
+
+#include <cstring>
+#include <cwchar>
+
+static const size_t ChunkChars = 64 * 1024;
+
+PathStore& PathStore::shared()
+{
+	// Never destroyed: Process objects may outlive every ProcessList. The
+	// other shared() instances leak the same way, so timers, spans and
+	// icons still in use while the process exits never find them gone.
+	static PathStore* store = new PathStore();
+
+	return *store;
+}
+
+uint32_t PathStore::hash(const wchar_t* str, size_t len)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; ++i) {
+		h ^= (uint32_t)str[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+const wchar_t* PathStore::store(const wchar_t* str, size_t len)
+{
+	if (m_chunkUsed + len + 1 > m_chunkSize) {
+		m_chunkSize = len + 1 > ChunkChars ? len + 1 : ChunkChars;
+		m_chunkUsed = 0;
+		m_chunks.emplace_back(new wchar_t[m_chunkSize]);
+	}
+
+	wchar_t* dst = m_chunks.back().get() + m_chunkUsed;
+	memcpy(dst, str, len * sizeof(wchar_t));
+	dst[len] = 0;
+
+	m_chunkUsed += len + 1;
+	m_bytes += (len + 1) * sizeof(wchar_t);
+
+	return dst;
+}
+
+void PathStore::grow()
+{
+	std::vector<PathId> table(m_table.empty() ? 1024 : m_table.size() * 2, InvalidPathId);
+	const size_t mask = table.size() - 1;
+
+	for (size_t i = 0; i < m_entries.size(); ++i) {
+		size_t slot = m_entries[i].hash & mask;
+
+		while (table[slot] != InvalidPathId) {
+			slot = (slot + 1) & mask;
+		}
+
+		table[slot] = (PathId)(i + 1);
+	}
+
+	m_table.swap(table);
+}
+
+PathId PathStore::intern(const wchar_t* str, size_t len)
+{
+	if (!str || !len) {
+		return InvalidPathId;
+	}
+
+	const uint32_t h = hash(str, len);
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if ((m_entries.size() + 1) * 2 > m_table.size()) {
+		grow();
+	}
+
+	const size_t mask = m_table.size() - 1;
+	size_t slot = h & mask;
+
+	while (m_table[slot] != InvalidPathId) {
+		const Entry& entry = m_entries[m_table[slot] - 1];
+
+		if (entry.hash == h && entry.len == len && wmemcmp(entry.str, str, len) == 0) {
+			return m_table[slot];
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	m_entries.push_back({ store(str, len), (uint32_t)len, h });
+	m_table[slot] = (PathId)m_entries.size();
+
+	return m_table[slot];
+}
+
+const wchar_t* PathStore::get(PathId id) const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (id == InvalidPathId || id > m_entries.size()) {
+		return L"";
+	}
+
+	return m_entries[id - 1].str;
+}
+
+size_t PathStore::length(PathId id) const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (id == InvalidPathId || id > m_entries.size()) {
+		return 0;
+	}
+
+	return m_entries[id - 1].len;
+}
+
+size_t PathStore::count() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_entries.size();
+}
+
+size_t PathStore::bytes() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_bytes;
+}
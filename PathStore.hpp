@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef uint32_t PathId;
+
+static const PathId InvalidPathId = 0;
+
+// Interned, arena-backed path strings.
+//
+// A desktop runs dozens of svchost.exe and chrome.exe instances; their
+// image paths are stored once and processes refer to them by PathId.
+// Strings live in large chunks which are never freed or moved, so a
+// pointer returned by get() stays valid for the lifetime of the store, and
+// interning a path which is already known does not allocate.
+class PathStore
+{
+public:
+	PathStore() {}
+	PathStore(const PathStore&) = delete;
+	PathStore& operator=(const PathStore&) = delete;
+
+	// Store shared by every Process
+	static PathStore& shared();
+
+	PathId intern(const wchar_t* str, size_t len);
+
+	// Null-terminated path, empty for InvalidPathId
+	const wchar_t* get(PathId id) const;
+	size_t length(PathId id) const;
+
+	// Number of distinct paths and bytes of arena in use
+	size_t count() const;
+	size_t bytes() const;
+
+private:
+	struct Entry
+	{
+		const wchar_t* str;
+		uint32_t len;
+		uint32_t hash;
+	};
+
+	static uint32_t hash(const wchar_t* str, size_t len);
+
+	const wchar_t* store(const wchar_t* str, size_t len);
+	void grow();
+
+private:
+	mutable std::mutex m_mutex;
+
+	// Entry of PathId n is m_entries[n - 1]
+	std::vector<Entry> m_entries;
+
+	// Open addressing hash table of PathIds, size is a power of two
+	std::vector<PathId> m_table;
+
+	std::vector<std::unique_ptr<wchar_t[]>> m_chunks;
+	size_t m_chunkUsed = 0;
+	size_t m_chunkSize = 0;
+	size_t m_bytes = 0;
+};
@@ -0,0 +1,424 @@
+#include "stdafx.h"
+#include "PatternSet.hpp"
+
+#include <algorithm>
+#include <cwctype>
+
+void PatternSet::add(const std::wstring& pattern)
+{
+	std::vector<std::wstring> excluded;
+
+	insert(pattern, excluded);
+	exclude(excluded);
+
+	compile();
+}
+
+void PatternSet::add(const std::vector<std::wstring>& patterns)
+{
+	std::vector<std::wstring> excluded;
+
+	for (auto& pattern : patterns) {
+		insert(pattern, excluded);
+	}
+
+	exclude(excluded);
+
+	compile();
+}
+
+void PatternSet::clear()
+{
+	m_patterns.clear();
+	m_exclusions.reset();
+
+	compile();
+}
+
+static bool isSeparator(wchar_t c)
+{
+	return c == L'\\' || c == L'/';
+}
+
+// Replaces every run of '*' with star
+static std::wstring replaceStars(const std::wstring& pattern, const wchar_t* star)
+{
+	std::wstring result;
+
+	for (size_t i = 0; i < pattern.size(); ++i) {
+		if (pattern[i] != L'*') {
+			result.push_back(pattern[i]);
+		}
+		else if (i == 0 || pattern[i - 1] != L'*') {
+			result += star;
+		}
+	}
+
+	return result;
+}
+
+void PatternSet::addNames(const std::vector<std::wstring>& names)
+{
+	// Names hold no separators, so spanning stars match the same and keep
+	// "*.dll" complete for the prefilter
+	for (auto& name : names) {
+		m_patterns.emplace_back(replaceStars(name, L"**"));
+	}
+
+	compile();
+}
+
+void PatternSet::insert(const std::wstring& pattern, std::vector<std::wstring>& excluded)
+{
+	if (!pattern.empty() && pattern[0] == L'!') {
+		excluded.emplace_back(pattern.substr(1));
+		return;
+	}
+
+	// Compiled patterns mark a star which spans separators with a run of
+	// two or more, a single star stays within one name
+	const size_t lastSeparator = pattern.find_last_of(L"\\/");
+
+	// No directory to anchor to: the pattern matches anywhere
+	if (lastSeparator == std::wstring::npos) {
+		m_patterns.emplace_back(replaceStars(pattern, L"**"));
+		return;
+	}
+
+	// Directory segments, each with the separator after it
+	std::vector<std::wstring> directories;
+	bool wildcardDirectories = false;
+
+	for (size_t start = 0; start <= lastSeparator; ) {
+		size_t end = start;
+
+		while (!isSeparator(pattern[end])) {
+			++end;
+		}
+
+		std::wstring segment = pattern.substr(start, end - start);
+
+		if (segment != L"**") {
+			segment = replaceStars(segment, L"*");
+		}
+
+		wildcardDirectories = wildcardDirectories || segment.find_first_of(L"*?") != std::wstring::npos;
+
+		directories.push_back(segment + pattern[end]);
+		start = end + 1;
+	}
+
+	std::wstring file = pattern.substr(lastSeparator + 1);
+	std::wstring tail;
+
+	if (file.empty() || file == L"**") {
+		// Everything below
+		tail = L"**";
+	}
+	else {
+		file = replaceStars(file, L"*");
+
+		if (wildcardDirectories) {
+			tail = file;
+		}
+		else if (file[0] == L'*') {
+			// A file wildcard under a plain directory applies at any depth.
+			// With a leading star that is the same as a spanning one.
+			tail = L"**" + file.substr(1);
+		}
+		else {
+			tail = file;
+			directories.push_back(L"**" + pattern.substr(lastSeparator, 1));
+		}
+	}
+
+	// A "**" segment is zero directories, or a spanning star between two
+	// separators for one or more
+	std::vector<std::wstring> expanded = { std::wstring() };
+
+	for (auto& directory : directories) {
+		const bool anyDepth = directory.size() == 3 && directory[0] == L'*' && directory[1] == L'*';
+		const size_t count = expanded.size();
+
+		for (size_t i = 0; i < count; ++i) {
+			if (anyDepth) {
+				expanded.push_back(expanded[i]);
+			}
+
+			expanded[i] += directory;
+		}
+	}
+
+	for (auto& prefix : expanded) {
+		m_patterns.emplace_back(prefix + tail);
+	}
+}
+
+void PatternSet::exclude(const std::vector<std::wstring>& patterns)
+{
+	if (patterns.empty()) {
+		return;
+	}
+
+	// Copies of this set share the exclusions, so they are replaced rather
+	// than changed
+	auto next = m_exclusions ? std::make_shared<PatternSet>(*m_exclusions) : std::make_shared<PatternSet>();
+	next->add(patterns);
+
+	m_exclusions = std::move(next);
+}
+
+wchar_t PatternSet::fold(wchar_t c)
+{
+	return (wchar_t)towupper(c);
+}
+
+void PatternSet::compile()
+{
+	// Tokenize: collapse runs of '*' and fold literal characters
+	enum Star : uint8_t
+	{
+		NoStar,
+		NameStar,     // '*', stops at separators
+		SpanningStar, // "**"
+	};
+
+	struct Compiled
+	{
+		std::wstring tokens;
+		std::vector<Star> starBefore; // tokens.size() + 1 entries
+	};
+
+	m_prefilter.build(m_patterns);
+
+	std::vector<Compiled> compiled;
+	std::vector<wchar_t> alphabet;
+	size_t bits = 0;
+
+	alphabet.push_back(L'.');
+	alphabet.push_back(L'\\');
+	alphabet.push_back(L'/');
+
+	for (auto& pattern : m_patterns) {
+		Compiled c;
+		Star star = NoStar;
+
+		for (wchar_t ch : pattern) {
+			if (ch == L'*') {
+				star = star == NoStar ? NameStar : SpanningStar;
+				continue;
+			}
+
+			c.starBefore.push_back(star);
+			star = NoStar;
+
+			if (ch == L'?') {
+				c.tokens.push_back(ch);
+			}
+			else {
+				c.tokens.push_back(fold(ch));
+				alphabet.push_back(fold(ch));
+			}
+		}
+		c.starBefore.push_back(star);
+
+		bits += c.tokens.size() + 1;
+		compiled.emplace_back(std::move(c));
+	}
+
+	std::sort(alphabet.begin(), alphabet.end());
+	alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+	// Class 0 is reserved for characters which never appear literally
+	const size_t classes = alphabet.size() + 1;
+
+	m_words = (bits + 63) / 64;
+	m_start.assign(m_words, 0);
+	m_accept.assign(m_words, 0);
+	m_loop.assign(m_words, 0);
+	m_spanningLoop.assign(m_words, 0);
+	m_advance.assign(classes * m_words, 0);
+
+	auto set = [](std::vector<uint64_t>& v, size_t offset, size_t bit) {
+		v[offset + bit / 64] |= (uint64_t)1 << (bit % 64);
+	};
+
+	size_t base = 0;
+	for (auto& c : compiled) {
+		set(m_start, 0, base);
+		set(m_accept, 0, base + c.tokens.size());
+
+		for (size_t j = 0; j <= c.tokens.size(); ++j) {
+			if (c.starBefore[j] != NoStar) {
+				set(m_loop, 0, base + j);
+			}
+
+			if (c.starBefore[j] == SpanningStar) {
+				set(m_spanningLoop, 0, base + j);
+			}
+		}
+
+		for (size_t j = 0; j < c.tokens.size(); ++j) {
+			const wchar_t token = c.tokens[j];
+
+			if (token == L'?') {
+				// Any character but '.' and separators
+				set(m_advance, 0, base + j);
+
+				for (size_t cls = 1; cls < classes; ++cls) {
+					if (alphabet[cls - 1] != L'.' && !isSeparator(alphabet[cls - 1])) {
+						set(m_advance, cls * m_words, base + j);
+					}
+				}
+			}
+			else {
+				size_t cls = 1 + (std::lower_bound(alphabet.begin(), alphabet.end(), token) - alphabet.begin());
+
+				set(m_advance, cls * m_words, base + j);
+			}
+		}
+
+		base += c.tokens.size() + 1;
+	}
+
+	// Character to class lookup, case folding is resolved here once
+	m_wideClass.clear();
+	for (size_t cls = 1; cls < classes; ++cls) {
+		if (alphabet[cls - 1] >= 128) {
+			m_wideClass.emplace_back(alphabet[cls - 1], (uint16_t)cls);
+		}
+	}
+
+	for (wchar_t ch = 0; ch < 128; ++ch) {
+		const wchar_t folded = fold(ch);
+		auto it = std::lower_bound(alphabet.begin(), alphabet.end(), folded);
+
+		if (it != alphabet.end() && *it == folded) {
+			m_asciiClass[ch] = (uint16_t)(1 + (it - alphabet.begin()));
+		}
+		else {
+			m_asciiClass[ch] = 0;
+		}
+	}
+
+	m_separatorClass[0] = m_asciiClass[L'\\'];
+	m_separatorClass[1] = m_asciiClass[L'/'];
+}
+
+uint16_t PatternSet::classOf(wchar_t c) const
+{
+	if ((unsigned)c < 128) {
+		return m_asciiClass[c];
+	}
+
+	const wchar_t folded = fold(c);
+
+	if ((unsigned)folded < 128) {
+		return m_asciiClass[folded];
+	}
+
+	auto it = std::lower_bound(
+		m_wideClass.begin(),
+		m_wideClass.end(),
+		folded,
+		[](const std::pair<wchar_t, uint16_t>& entry, wchar_t value) { return entry.first < value; });
+
+	if (it != m_wideClass.end() && it->first == folded) {
+		return it->second;
+	}
+
+	return 0;
+}
+
+bool PatternSet::match(const wchar_t* str) const
+{
+	if (!str) {
+		return false;
+	}
+
+	return match(str, wcslen(str));
+}
+
+bool PatternSet::match(const wchar_t* str, size_t len) const
+{
+	if (!matchIncluded(str, len)) {
+		return false;
+	}
+
+	return !m_exclusions || !m_exclusions->match(str, len);
+}
+
+bool PatternSet::matchIncluded(const wchar_t* str, size_t len) const
+{
+	if (!m_words) {
+		return false;
+	}
+
+	switch (m_prefilter.test(str, len)) {
+	case LiteralPrefilter::Reject:
+		return false;
+	case LiteralPrefilter::Accept:
+		return true;
+	default:
+		break;
+	}
+
+	const size_t localWords = 32;
+	uint64_t local[localWords];
+	std::vector<uint64_t> heap;
+
+	uint64_t* state = local;
+	if (m_words > localWords) {
+		heap.resize(m_words);
+		state = heap.data();
+	}
+
+	std::copy(m_start.begin(), m_start.end(), state);
+
+	// Only words in [lo, hi) can hold live states; the range shrinks
+	// quickly for paths which fall out of most patterns early.
+	size_t lo = 0;
+	size_t hi = m_words;
+
+	for (size_t i = 0; i < len; ++i) {
+		const uint16_t cls = classOf(str[i]);
+		const uint64_t* advance = &m_advance[cls * m_words];
+		const uint64_t* loop = cls == m_separatorClass[0] || cls == m_separatorClass[1] ? m_spanningLoop.data() : m_loop.data();
+		const size_t end = hi < m_words ? hi + 1 : m_words;
+
+		uint64_t carry = 0;
+		size_t nextLo = end;
+		size_t nextHi = 0;
+
+		for (size_t w = lo; w < end; ++w) {
+			const uint64_t current = state[w];
+			const uint64_t moved = current & advance[w];
+			const uint64_t next = (moved << 1) | carry | (current & loop[w]);
+
+			carry = moved >> 63;
+			state[w] = next;
+
+			if (next) {
+				if (nextLo == end) {
+					nextLo = w;
+				}
+				nextHi = w + 1;
+			}
+		}
+
+		if (!nextHi) {
+			return false;
+		}
+
+		lo = nextLo;
+		hi = nextHi;
+	}
+
+	for (size_t w = lo; w < hi; ++w) {
+		if (state[w] & m_accept[w]) {
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "LiteralPrefilter.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Compiled set of case-insensitive wildcard patterns ('*' and '?').
+//
+// All patterns are merged into one bit-parallel NFA: every non-star pattern
+// character owns one bit of the state vector, a '*' turns the bit before it
+// into a self-loop. A path is tested against every pattern in a single
+// left-to-right pass, so matching is linear in the path length no matter how
+// many stars the patterns contain.
+//
+// A LiteralPrefilter on the literal prefix and suffix of each pattern runs
+// first and settles most paths without touching the NFA.
+//
+// Path patterns match directory segments the same way FileScanner does:
+// '?' matches any character except '.' and separators, '*' any run of
+// characters within one name, and a "**" segment zero or more directories.
+// "<dir>\<file wildcard>" applies the wildcard at any depth below the
+// directory, a trailing "**" or separator matches everything below it.
+// Patterns without a separator match anywhere, their stars span separators.
+//
+// Patterns starting with '!' are exclusions: a string matching any of them
+// does not match the set.
+class PatternSet
+{
+public:
+	PatternSet() {}
+
+	void add(const std::wstring& pattern);
+	void add(const std::vector<std::wstring>& patterns);
+	void clear();
+
+	// Patterns for single names: no separators and no exclusions, a leading
+	// '!' is literal
+	void addNames(const std::vector<std::wstring>& names);
+
+	bool empty() const { return m_patterns.empty(); }
+	size_t size() const { return m_patterns.size(); }
+
+	// Inclusions only, "**" segments expanded; a run of two or more stars
+	// spans separators, a single star does not
+	const std::vector<std::wstring>& patterns() const { return m_patterns; }
+
+	bool match(const wchar_t* str) const;
+	bool match(const wchar_t* str, size_t len) const;
+
+private:
+	void insert(const std::wstring& pattern, std::vector<std::wstring>& excluded);
+	void exclude(const std::vector<std::wstring>& patterns);
+	bool matchIncluded(const wchar_t* str, size_t len) const;
+
+	void compile();
+	uint16_t classOf(wchar_t c) const;
+
+	static wchar_t fold(wchar_t c);
+
+private:
+	std::vector<std::wstring> m_patterns;
+	LiteralPrefilter m_prefilter;
+
+	// Set of the '!' patterns, null when there are none
+	std::shared_ptr<const PatternSet> m_exclusions;
+
+	// Number of 64-bit words in the state vector
+	size_t m_words = 0;
+
+	// Initial state, accepting states and self-looping ('*') states. Only
+	// the spanning ones loop on a separator.
+	std::vector<uint64_t> m_start;
+	std::vector<uint64_t> m_accept;
+	std::vector<uint64_t> m_loop;
+	std::vector<uint64_t> m_spanningLoop;
+
+	// Per character class: states which advance on a character of the class.
+	// Class 0 is "any character not used literally in any pattern".
+	std::vector<uint64_t> m_advance;
+
+	uint16_t m_asciiClass[128] = { 0 };
+	uint16_t m_separatorClass[2] = { 0 };
+	std::vector<std::pair<wchar_t, uint16_t>> m_wideClass;
+};
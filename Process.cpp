@@ -1,52 +1,39 @@
 #include "stdafx.h"
 #include "Process.hpp"
 
-#include <RestartManager.h>
 #include <string>
 #include <vector>
-#include <set>
-
-Process::Process(const DWORD id) :
-	m_id(id),
-	m_handle(0),
-	m_icon(0),
-	m_imagePath(0),
-	m_mainWindowTitle(0),
-	m_mainWindowHandle(0)
-{
-	m_handle = OpenProcess(
-		PROCESS_TERMINATE | 
-		PROCESS_QUERY_INFORMATION |
-		SYNCHRONIZE,
-		TRUE,
-		m_id);
 
-	if (m_handle) {
-		DWORD bufLen = 32768;
-		TCHAR* buf = new TCHAR[bufLen];
-
-		if (0 != QueryFullProcessImageName(
-			m_handle,
-			0,
-			buf,
-			&bufLen)) {
-			buf[bufLen] = 0;
-
-			m_imagePath = new TCHAR[bufLen + 1];
-			memcpy(m_imagePath, buf, (bufLen + 1) * sizeof(TCHAR));
-		}
+Process::Process(const ProcessKey& key, const PathId path) :
+	m_id(key.id),
+	m_startTime(key.startTime),
+	m_path(path)
+{
+}
 
-		delete[] buf;
+ProcessMetadataPtr Process::metadata()
+{
+	if (!m_metadataLoaded) {
+		m_metadata = MetadataCache::shared().acquire(m_path);
+		m_metadataLoaded = true;
 	}
+
+	return m_metadata;
 }
 
-const HICON Process::icon()
+const wchar_t* Process::displayName()
 {
-	if (!m_icon) {
-		m_icon = ExtractIcon(NULL, path(), 0);
-	}
+	// Kept alive by m_metadata
+	auto shared = metadata();
 
-	return m_icon;
+	return shared && !shared->displayName.empty() ? shared->displayName.c_str() : nullptr;
+}
+
+#ifdef _WIN32
+
+static ULONGLONG toULongLong(const FILETIME& ft)
+{
+	return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
 }
 
 Process::~Process()
@@ -54,24 +41,49 @@ Process::~Process()
 	if (m_handle) {
 		CloseHandle(m_handle);
 	}
+}
 
-	if (m_imagePath) {
-		delete[] m_imagePath;
-	}
+void Process::open()
+{
+	m_opened = true;
 
-	if (m_mainWindowTitle) {
-		delete[] m_mainWindowTitle;
+	m_handle = OpenProcess(
+		PROCESS_TERMINATE | 
+		PROCESS_QUERY_INFORMATION |
+		SYNCHRONIZE,
+		TRUE,
+		m_id);
+
+	FILETIME creation, exit, kernel, user;
+	if (m_handle && (!GetProcessTimes(m_handle, &creation, &exit, &kernel, &user) ||
+		toULongLong(creation) != m_startTime)) {
+		// The PID was reused since the key was taken, this is not our process
+		CloseHandle(m_handle);
+		m_handle = 0;
 	}
+}
 
-	if (m_icon) {
-		DestroyIcon(m_icon);
+const HANDLE Process::handle()
+{
+	if (!m_opened) {
+		open();
 	}
+
+	return m_handle;
+}
+
+const HICON Process::icon()
+{
+	// Owned by the shared metadata, not destroyed with the process
+	auto shared = metadata();
+
+	return shared ? shared->icon : NULL;
 }
 
 bool Process::running()
 {
 	DWORD exitCode;
-	if (GetExitCodeProcess(m_handle, &exitCode)) {
+	if (GetExitCodeProcess(handle(), &exitCode)) {
 		return (exitCode == STILL_ACTIVE);
 	}
 
@@ -81,174 +93,62 @@ bool Process::running()
 DWORD Process::exitCode()
 {
 	DWORD exitCode;
-	if (GetExitCodeProcess(m_handle, &exitCode)) {
+	if (GetExitCodeProcess(handle(), &exitCode)) {
 		return exitCode;
 	}
 
 	return 0xffffffffL;
 }
 
-const bool Process::queryAllProcesses(std::vector<std::shared_ptr<Process>>& output, std::function<bool(Process&)> filter)
+static WindowIndex& windowIndex()
 {
-	bool result = false;
-
-	const DWORD increment = 1024;
-	DWORD bufLen = sizeof(DWORD) * increment;
-	DWORD bufNeeded = 0;
-	DWORD* buf = new DWORD[bufLen / sizeof(DWORD)];
-
-	while (EnumProcesses(buf, bufLen, &bufNeeded)) {
-		if (bufNeeded < bufLen) {
-			result = true;
-
-			break;
-		}
-		else {
-			delete[] buf;
-			bufLen += (sizeof(DWORD) * increment);
-			buf = new DWORD[bufLen / sizeof(DWORD)];
-		}
-	}
-
-	if (result) {
-		for (size_t i = 0; i < bufLen / sizeof(DWORD); ++i) {
-			std::shared_ptr<Process> p = std::make_shared<Process>(buf[i]);
+	WindowIndex& index = WindowIndex::shared();
 
-			if (filter(*p)) {
-				output.emplace_back(p);
-			}
-		}
+	// Normally refreshed by the dialog before it asks
+	if (!index.generation()) {
+		index.refresh();
 	}
 
-	delete[] buf;
-
-	return result;
-}
-
-const bool Process::queryAllProcesses(std::vector<std::shared_ptr<Process>>& output)
-{
-	return queryAllProcesses(
-		output,
-		[](Process&) -> bool { return true; }
-	);
+	return index;
 }
 
 const HWND Process::mainWindowHandle()
 {
-	if (!m_mainWindowHandle) {
-		std::vector <HWND> vWindows;
-
-		HWND hwnd = NULL;
-
-		do
-		{
-			hwnd = FindWindowEx(GetDesktopWindow(), hwnd, NULL, NULL);
-
-			if (IsWindowVisible(hwnd)) {
-				DWORD dwPID = 0;
-				GetWindowThreadProcessId(hwnd, &dwPID);
-				if (dwPID == id()) {
-					vWindows.push_back(hwnd);
-				}
-			}
-		} while (hwnd != NULL);
-
-		if (vWindows.size() > 0) {
-			m_mainWindowHandle = vWindows[0];
-		}
-	}
-
-	return m_mainWindowHandle;
+	return (HWND)windowIndex().mainWindow(id());
 }
 
 const TCHAR* const Process::mainWindowTitle()
 {
-	if (!m_mainWindowTitle) {
-		HWND hwnd = mainWindowHandle();
+	WindowIndex& index = windowIndex();
 
-		if (hwnd) {
-			const size_t increment = 32;
-			size_t bufLen = 256;
-			TCHAR* buf = new TCHAR[bufLen];
+	// Titles change, they are read again once per refresh of the index
+	if (m_windowGeneration != index.generation()) {
+		m_windowGeneration = index.generation();
+		m_mainWindowTitle.clear();
 
-			size_t textLen = GetWindowText(hwnd, buf, (int)bufLen);
-			while (textLen >= bufLen - 1) {
-				delete[] buf;
-				bufLen += increment;
-				buf = new TCHAR[bufLen];
+		std::wstring title;
 
-				textLen = GetWindowText(hwnd, buf, (int)bufLen);
-			}
+		if (index.mainWindowTitle(id(), title)) {
+#ifdef UNICODE
+			m_mainWindowTitle = title;
+#else
+			int len = WideCharToMultiByte(CP_ACP, 0, title.c_str(), (int)title.size(), NULL, 0, NULL, NULL);
 
-			if (textLen > 0) {
-				m_mainWindowTitle = buf;
-			}
-			else {
-				delete[] buf;
+			if (len > 0) {
+				m_mainWindowTitle.resize((size_t)len);
+				WideCharToMultiByte(CP_ACP, 0, title.c_str(), (int)title.size(), &m_mainWindowTitle[0], len, NULL, NULL);
 			}
+#endif
 		}
 	}
 
-	return m_mainWindowTitle;
+	return m_mainWindowTitle.empty() ? nullptr : m_mainWindowTitle.c_str();
 }
 
-#pragma comment(lib, "Rstrtmgr.lib")
-const bool Process::queryAllProcesses(std::vector<std::wstring>& lockedFiles, std::vector<std::shared_ptr<Process>>& output)
-{
-	bool returnVal = false;
-
-	DWORD dwSession;
-	WCHAR szSessionKey[CCH_RM_SESSION_KEY + 1] = { 0 };
-	DWORD dwError = RmStartSession(&dwSession, 0, szSessionKey);
+#else
 
-	if (dwError != ERROR_SUCCESS)
-		return false;
-
-	std::vector<LPCWSTR> filesArray;
-	for (auto& i : lockedFiles) {
-		filesArray.push_back(i.c_str());
-	}
-
-	dwError = RmRegisterResources(dwSession, (UINT)filesArray.size(), filesArray.data(),
-		0, NULL, 0, NULL);
-
-	if (dwError == ERROR_SUCCESS) {
-		DWORD dwReason;
-		UINT nProcInfoNeeded = 0;
-		UINT nProcInfo = 0;
-
-		dwError = RmGetList(dwSession, &nProcInfoNeeded, &nProcInfo, nullptr, &dwReason);
-
-		if (dwError == ERROR_SUCCESS) {
-			returnVal = true;
-		}
-		else if (dwError == ERROR_MORE_DATA) {
-			nProcInfo = nProcInfoNeeded;
-
-			std::vector<RM_PROCESS_INFO> result;
-			result.resize(nProcInfo);
-
-			dwError = RmGetList(dwSession, &nProcInfoNeeded,
-				&nProcInfo, result.data(), &dwReason);
-
-			returnVal = dwError == ERROR_SUCCESS;
-
-			std::set<DWORD> seenProcessIds;
-
-			for (auto& proc : result) {
-				if (seenProcessIds.count(proc.Process.dwProcessId))
-					continue;
-
-				seenProcessIds.emplace(proc.Process.dwProcessId);
-
-				std::shared_ptr<Process> pi = std::make_shared<Process>(proc.Process.dwProcessId);
-
-				output.push_back(pi);
-			}
-		}
-	}
-
-	RmEndSession(dwSession);
-
-	return returnVal;
+Process::~Process()
+{
 }
+
+#endif
@@ -1,33 +1,55 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
 #include <processthreadsapi.h>
 #include <psapi.h>
+#endif
+
+#include "MetadataCache.hpp"
+#include "PathStore.hpp"
+#include "ProcessSource.hpp"
+#include "WindowIndex.hpp"
 
 #include <string>
 #include <vector>
-#include <functional>
 #include <memory>
 
+// A matched process as shown in the dialog. The key and the path come from
+// the ProcessSource; on Windows the process itself is only opened once it
+// is asked for its icon, its window or to terminate.
 class Process
 {
 public:
 	Process() {}
-	Process(const DWORD id);
-	Process(const Process& other) : Process(other.m_id) {}
+	Process(const ProcessKey& key, const PathId path = InvalidPathId);
+	Process(const Process& other) : Process(other.key(), other.pathId()) {}
 	~Process();
 
-	const DWORD id() const { return m_id; }
-	const HANDLE handle() const { return m_handle; }
-	const TCHAR* const path() const { return m_imagePath; }
+	const ProcessId id() const { return m_id; }
+	const uint64_t startTime() const { return m_startTime; }
+	const ProcessKey key() const { return { m_id, m_startTime }; }
+	const PathId pathId() const { return m_path; }
+	const wchar_t* const path() const { return PathStore::shared().get(m_path); }
+
+	bool compare(Process& other) { return m_id == other.m_id; }
+
+	// Shared with every process of the same executable, null if it cannot
+	// be read
+	ProcessMetadataPtr metadata();
+
+	// File description of the executable, else its file name; null if the
+	// metadata cannot be read
+	const wchar_t* displayName();
+
+#ifdef _WIN32
+	const HANDLE handle();
 	const HICON icon();
 	const HWND mainWindowHandle();
 	const TCHAR* const mainWindowTitle();
 
-	bool compare(Process& other) { return m_id == other.m_id; }
-
-	bool terminateAsync(const UINT exitCode) { return ::TerminateProcess(m_handle, exitCode); }
-	bool wait(const DWORD timeoutMilliseconds = INFINITE) { return ::WaitForSingleObject(m_handle, timeoutMilliseconds) == WAIT_OBJECT_0; }
+	bool terminateAsync(const UINT exitCode) { return ::TerminateProcess(handle(), exitCode); }
+	bool wait(const DWORD timeoutMilliseconds = INFINITE) { return ::WaitForSingleObject(handle(), timeoutMilliseconds) == WAIT_OBJECT_0; }
 	bool terminate(const UINT exitCode, const DWORD timeoutMilliseconds = INFINITE)
 	{
 		if (terminateAsync(exitCode)) {
@@ -39,15 +61,22 @@ public:
 	bool running();
 	DWORD exitCode();
 
-	static const bool queryAllProcesses(std::vector<std::shared_ptr<Process>>& output, std::function<bool(Process&)> filter);
-	static const bool queryAllProcesses(std::vector<std::shared_ptr<Process>>& output);
-	static const bool queryAllProcesses(std::vector<std::wstring>& lockedFiles, std::vector<std::shared_ptr<Process>>& output);
+private:
+	void open();
+#endif
 
 private:
-	DWORD m_id = 0;
-	HANDLE m_handle = INVALID_HANDLE_VALUE;
-	TCHAR* m_imagePath = nullptr;
-	HICON m_icon = (HICON)INVALID_HANDLE_VALUE;
-	TCHAR* m_mainWindowTitle = nullptr;
-	HWND m_mainWindowHandle = (HWND)INVALID_HANDLE_VALUE;
+	ProcessId m_id = 0;
+	uint64_t m_startTime = 0;
+	PathId m_path = InvalidPathId;
+
+	bool m_metadataLoaded = false;
+	ProcessMetadataPtr m_metadata;
+
+#ifdef _WIN32
+	bool m_opened = false;
+	HANDLE m_handle = 0;
+	std::basic_string<TCHAR> m_mainWindowTitle;
+	size_t m_windowGeneration = 0;
+#endif
 };
@@ -0,0 +1,191 @@
+#include "stdafx.h"
+#include "ProcessEventSource.hpp"
+
+#ifdef __linux__
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#endif
+
+#ifdef __linux__
+
+// Subscribes to the kernel's proc connector, which multicasts fork, exec
+// and exit of every task. Needs CAP_NET_ADMIN; without it live() is false.
+class NetlinkProcessEventSource : public ProcessEventSource
+{
+public:
+	NetlinkProcessEventSource()
+	{
+		m_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		m_socket = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+
+		if (m_wake < 0 || m_socket < 0) {
+			return;
+		}
+
+		sockaddr_nl address = {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = CN_IDX_PROC;
+
+		if (bind(m_socket, (sockaddr*)&address, sizeof(address)) < 0) {
+			return;
+		}
+
+		m_live = control(PROC_CN_MCAST_LISTEN);
+	}
+
+	~NetlinkProcessEventSource()
+	{
+		if (m_live) {
+			control(PROC_CN_MCAST_IGNORE);
+		}
+
+		if (m_socket >= 0) {
+			close(m_socket);
+		}
+
+		if (m_wake >= 0) {
+			close(m_wake);
+		}
+	}
+
+	bool live() const override
+	{
+		return m_live;
+	}
+
+	bool wait(std::chrono::milliseconds timeout, std::vector<ProcessEvent>& events) override
+	{
+		pollfd fds[2] = {
+			{ m_wake, POLLIN, 0 },
+			{ m_socket, POLLIN, 0 },
+		};
+
+		if (poll(fds, 2, (int)timeout.count()) <= 0 || fds[0].revents) {
+			return true;
+		}
+
+		bool complete = true;
+		alignas(nlmsghdr) char buf[16384];
+
+		for (;;) {
+			ssize_t len = recv(m_socket, buf, sizeof(buf), 0);
+
+			if (len <= 0) {
+				// ENOBUFS: the socket buffer overflowed and events were dropped
+				if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+					complete = false;
+				}
+
+				break;
+			}
+
+			for (auto header = (nlmsghdr*)buf; NLMSG_OK(header, (size_t)len); header = NLMSG_NEXT(header, len)) {
+				if (header->nlmsg_type == NLMSG_OVERRUN) {
+					complete = false;
+					continue;
+				}
+
+				if (header->nlmsg_type != NLMSG_DONE) {
+					continue;
+				}
+
+				auto message = (const cn_msg*)NLMSG_DATA(header);
+				auto event = (const proc_event*)message->data;
+
+				// Threads come and go through the same events, only whole
+				// processes (thread group leaders) matter
+				switch (event->what) {
+				case proc_event::PROC_EVENT_FORK:
+					if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+						events.push_back({ ProcessEvent::Start, (ProcessId)event->event_data.fork.child_tgid });
+					}
+					break;
+				case proc_event::PROC_EVENT_EXEC:
+					events.push_back({ ProcessEvent::Start, (ProcessId)event->event_data.exec.process_tgid });
+					break;
+				case proc_event::PROC_EVENT_EXIT:
+					if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+						events.push_back({ ProcessEvent::Exit, (ProcessId)event->event_data.exit.process_tgid });
+					}
+					break;
+				default:
+					break;
+				}
+			}
+		}
+
+		return complete;
+	}
+
+	void interrupt() override
+	{
+		uint64_t one = 1;
+
+		if (write(m_wake, &one, sizeof(one)) < 0) {
+			// Counter saturated, a wakeup is pending anyway
+		}
+	}
+
+private:
+	bool control(proc_cn_mcast_op op)
+	{
+		alignas(nlmsghdr) char buf[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+
+		auto header = (nlmsghdr*)buf;
+		header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+		header->nlmsg_type = NLMSG_DONE;
+		header->nlmsg_pid = 0;
+
+		auto message = (cn_msg*)NLMSG_DATA(header);
+		message->id.idx = CN_IDX_PROC;
+		message->id.val = CN_VAL_PROC;
+		message->len = sizeof(proc_cn_mcast_op);
+		memcpy(message->data, &op, sizeof(op));
+
+		return send(m_socket, buf, header->nlmsg_len, 0) >= 0;
+	}
+
+private:
+	int m_socket = -1;
+	int m_wake = -1;
+	bool m_live = false;
+};
+
+#endif
+
+bool NullProcessEventSource::wait(std::chrono::milliseconds timeout, std::vector<ProcessEvent>&)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_event.wait_for(lock, timeout, [this] { return m_interrupted; });
+
+	return true;
+}
+
+void NullProcessEventSource::interrupt()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_interrupted = true;
+	m_event.notify_all();
+}
+
+std::unique_ptr<ProcessEventSource> ProcessEventSource::create()
+{
+#ifdef __linux__
+	auto netlink = std::make_unique<NetlinkProcessEventSource>();
+
+	if (netlink->live()) {
+		return netlink;
+	}
+#endif
+
+	return std::make_unique<NullProcessEventSource>();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Process start and exit notifications, so ProcessList can react within
+// milliseconds instead of on its next poll.
+//
+// Backends: the netlink proc connector on Linux. Where no backend is
+// available live() is false and ProcessList keeps polling at its usual
+// rate; ETW can fill this slot on Windows.
+struct ProcessEvent
+{
+	enum Type
+	{
+		// A new process, or a process which replaced its image
+		Start,
+		Exit
+	};
+
+	Type type;
+	ProcessId id;
+};
+
+class ProcessEventSource
+{
+public:
+	virtual ~ProcessEventSource() {}
+
+	// True if events are actually delivered
+	virtual bool live() const = 0;
+
+	// Blocks until events arrive, the timeout expires or interrupt() is
+	// called, and appends what arrived. Returns false if events were lost,
+	// in which case the caller has to rescan.
+	virtual bool wait(std::chrono::milliseconds timeout, std::vector<ProcessEvent>& events) = 0;
+
+	// Makes the current and every later wait() return immediately
+	virtual void interrupt() = 0;
+
+	// Best source for this platform, a NullProcessEventSource if there is
+	// none or it cannot be used
+	static std::unique_ptr<ProcessEventSource> create();
+};
+
+// Delivers nothing, wait() only sleeps
+class NullProcessEventSource : public ProcessEventSource
+{
+public:
+	bool live() const override { return false; }
+	bool wait(std::chrono::milliseconds timeout, std::vector<ProcessEvent>& events) override;
+	void interrupt() override;
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	bool m_interrupted = false;
+};
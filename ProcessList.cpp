@@ -1,78 +1,43 @@
 #include "stdafx.h"
 #include "ProcessList.hpp"
-#include <filesystem>
-#include <windows.h>
-
-// Function: Search using wildcards.
-//
-// http://xoomer.virgilio.it/acantato/dev/wildcard/wildmatch.html#evolution
-//
-static BOOL wildcmp(const wchar_t* pat, const wchar_t* str) {
-	wchar_t* s;
-	wchar_t* p;
-	BOOL star = FALSE;
-
-loopStart:
-	for (s = const_cast<wchar_t*>(str), p = const_cast<wchar_t*>(pat); *s; ++s, ++p) {
-		switch (*p) {
-		case L'?':
-			if (*s == L'.') goto starCheck;
-			break;
-		case L'*':
-			star = TRUE;
-			str = s, pat = p;
-			do { ++pat; } while (*pat == L'*');
-			if (!*pat) return TRUE;
-			goto loopStart;
-		default:
-			// if (_totupper(*s) != _totupper(*p))
-			if (towupper(*s) != towupper(*p))
-				goto starCheck;
-			break;
-		} /* endswitch */
-	} /* endfor */
-	while (*p == L'*') ++p;
-	return (!*p);
-
-starCheck:
-	if (!star) return FALSE;
-	str++;
-	goto loopStart;
-}
-
-static void GetFilesByWildcard(std::wstring rootPath, std::wstring wildcard, std::vector<std::wstring>& output)
-{
-	for (auto& entry :
-		std::filesystem::recursive_directory_iterator(
-			rootPath)) {
-
-		if (!entry.is_regular_file())
-			continue;
+#include "Metrics.hpp"
 
-		if (wildcmp(wildcard.c_str(), entry.path().wstring().c_str())) {
-			output.push_back(entry.path().wstring());
-		}
-	}
-}
+#include <algorithm>
 
-ProcessList::ProcessList(ProcessListMode mode) :
-	m_dirty(false),
-	m_running(true),
+// Full poll interval when process events are live
+static const int SweepIntervalMilliseconds = 30000;
+
+ProcessList::ProcessList(ProcessListMode mode, std::unique_ptr<ProcessSource> source, bool background,
+	std::unique_ptr<ProcessEventSource> events) :
+	m_patterns(std::make_shared<Patterns>()),
+	m_published(std::make_shared<ProcessListSnapshot>()),
+	m_source(std::move(source)),
+	m_events(events ? std::move(events) : std::make_unique<NullProcessEventSource>()),
+	m_exited(!background),
+	m_running(background),
 	m_mode(mode)
 {
-	update();
+	if (background) {
+		m_exits = ExitWatcher::create(*m_source, [this](const ProcessKey& key) { onExit(key); });
+	}
 
-	m_thread = std::thread(thread, this);
-	m_thread.detach();
+	// No scan yet: without patterns nothing can match, the first scan runs
+	// when patterns are added
+
+	if (background) {
+		m_thread = std::thread(thread, this);
+		m_thread.detach();
+	}
 }
 
 ProcessList::~ProcessList()
 {
 	m_running = false;
+	m_events->interrupt();
 
 	{
-		std::unique_lock<std::mutex> lock(m_event_mutex);
-		m_event.notify_one();
+		std::lock_guard<std::mutex> guard(m_pauseMutex);
+		m_pauseEvent.notify_all();
 	}
 
 	/*
@@ -81,180 +46,727 @@ ProcessList::~ProcessList()
 	}*/
 
 	{
+		// The thread may be done before we get here
 		std::unique_lock<std::mutex> lock(m_exit_event_mutex);
-		m_exit_event.wait(lock);
+		m_exit_event.wait(lock, [this] { return m_exited; });
 	}
+
+	// A requested scan in flight still uses the source
+	if (m_requestThread.joinable()) {
+		m_requestThread.join();
+	}
+
+	// Waits for callbacks in flight, which take m_mutex
+	m_exits.reset();
 }
 
-void ProcessList::addPattern(const TCHAR* pattern)
+void ProcessList::addPattern(const std::wstring& pattern)
 {
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	addPatterns({ pattern });
+}
 
-#ifdef UNICODE
-	m_patternList.emplace_back(std::wstring(pattern));
-#else
-	std::string s(pattern);
-	m_patternList.emplace_back(std::wstring(s.begin(), s.end()));
-#endif
+void ProcessList::addPatterns(const std::vector<std::wstring>& patterns, bool wait)
+{
+	storePatterns(patterns);
 
-	update();
+	if (wait) {
+		update();
+	}
+	else {
+		requestUpdate();
+	}
+}
+
+void ProcessList::setMode(ProcessListMode mode)
+{
+	m_mode = mode;
+}
+
+void ProcessList::pause()
+{
+	std::lock_guard<std::mutex> guard(m_pauseMutex);
+
+	m_paused = true;
+}
+
+bool ProcessList::resume()
+{
+	std::lock_guard<std::mutex> guard(m_pauseMutex);
+
+	const bool paused = m_paused;
+
+	m_paused = false;
+	m_pauseEvent.notify_all();
+
+	return paused;
+}
+
+void ProcessList::setSchedule(const RescanPolicy& policy)
+{
+	m_scheduler.setPolicy(policy);
 }
 
-void ProcessList::addPatterns(const std::vector<std::wstring>& patterns)
+void ProcessList::requestUpdate()
 {
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	std::lock_guard<std::mutex> guard(m_requestMutex);
 
-	for (auto& pattern : patterns) {
-		m_patternList.emplace_back(pattern);
+	++m_requested;
+
+	if (m_scanning) {
+		return;
+	}
+
+	// The previous worker is done or about to return
+	if (m_requestThread.joinable()) {
+		m_requestThread.join();
+	}
+
+	m_scanning = true;
+	m_requestThread = std::thread([this] { scanRequested(); });
+}
+
+void ProcessList::waitForUpdate()
+{
+	std::unique_lock<std::mutex> lock(m_requestMutex);
+
+	m_requestEvent.wait(lock, [this] { return m_completed == m_requested; });
+}
+
+void ProcessList::scanRequested()
+{
+	Trace::nameThread("scan-request");
+
+	std::unique_lock<std::mutex> lock(m_requestMutex);
+
+	while (m_completed != m_requested) {
+		// Covers every request made before it starts
+		const size_t requested = m_requested;
+
+		lock.unlock();
+		update();
+		lock.lock();
+
+		m_completed = requested;
+		m_requestEvent.notify_all();
 	}
 
-	update();
+	m_scanning = false;
+}
+
+void ProcessList::storePatterns(const std::vector<std::wstring>& patterns)
+{
+	std::lock_guard<std::mutex> guard(m_patternMutex);
+
+	// Scans in flight keep matching against the set they loaded
+	auto next = std::make_shared<Patterns>(*std::atomic_load(&m_patterns));
+
+	next->list.insert(next->list.end(), patterns.begin(), patterns.end());
+	next->set.add(patterns);
+	++next->generation;
+
+	std::atomic_store(&m_patterns, std::shared_ptr<const Patterns>(std::move(next)));
 }
 
-bool ProcessList::match(const TCHAR* path)
+bool ProcessList::query(ProcessListMode mode, const std::vector<std::wstring>& patterns,
+	std::vector<ProcessListItem>& output)
 {
-	if (!path) {
+	ProcessList list(mode, ProcessSource::create(), false);
+
+	list.storePatterns(patterns);
+
+	if (!list.update()) {
 		return false;
 	}
 
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	list.fill(output);
 
-#ifdef UNICODE
-	std::wstring wpath = path;
-#else
-	std::string ansiPath(path);
-	std::wstring wpath(ansiPath.begin(), ansiPath.end());
-#endif
-	for (auto pattern : m_patternList) {
-		if (wildcmp(pattern.c_str(), wpath.c_str())) {
-			return true;
-		}
+	return true;
+}
+
+bool ProcessList::match(const PatternSet& patterns, const PathId path)
+{
+	if (path == InvalidPathId) {
+		return false;
 	}
 
-	return false;
+	MetricsTimer timer(PhaseMatch);
+
+	const PathStore& paths = PathStore::shared();
+
+	return patterns.match(paths.get(path), paths.length(path));
 }
 
 bool ProcessList::update()
+{
+	bool refreshed;
+	bool listed;
+
+	MetricsTimer timer(PhaseUpdate);
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto cpu = RescanScheduler::threadCpuTime();
+
+	{
+		auto scanGuard = Metrics::lock(m_scanMutex);
+
+		m_scanList.clear();
+		m_scanExited.clear();
+
+		refreshed = refreshProcessCache(m_scanExited);
+		listed = refreshed && getProcessList(m_scanList);
+
+		// Published before the next scan starts: a stale result committed
+		// after a newer one would bring back processes which exited
+		if (refreshed) {
+			commit(m_scanList, m_scanExited, listed);
+		}
+
+		// Keeps the capacity, not the processes
+		m_scanList.clear();
+	}
+
+	Metrics::shared().add(CounterScans);
+
+	if (!listed) {
+		Metrics::shared().add(CounterScanFailures);
+	}
+
+	// A failed scan counts too, or the thread would retry it at once.
+	// Only this thread's CPU time: the Restart Manager service's share of
+	// a query is not ours to budget.
+	m_scheduler.completed(
+		std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start),
+		RescanScheduler::threadCpuTime() - cpu);
+
+	return listed;
+}
+
+bool ProcessList::handleEvents(const std::vector<ProcessEvent>& events)
 {
 	std::vector<ProcessListItem> list;
+	std::vector<ProcessKey> exited;
+	bool rescan = false;
 
-	if (!getProcessList(list)) {
-		return false;
+	{
+		auto scanGuard = Metrics::lock(m_scanMutex);
+
+		const auto patterns = std::atomic_load(&m_patterns);
+
+		for (auto& event : events) {
+			ProcessKey key = { event.id, 0 };
+			bool running = event.type == ProcessEvent::Start && m_source->key(event.id, key);
+
+			// Drop every other instance of the PID we know of: it exited,
+			// or its exit event was missed and the PID got reused
+			for (auto it = m_processCache.lower_bound({ event.id, 0 });
+				it != m_processCache.end() && it->first.id == event.id; ) {
+				if (running && it->first == key) {
+					++it;
+					continue;
+				}
+
+				exited.emplace_back(it->first);
+				it = m_processCache.erase(it);
+			}
+
+			if (!running) {
+				continue;
+			}
+
+			CachedProcess& entry = m_processCache[key];
+			entry.lastSeen = m_pollCount;
+
+			if (m_mode != PsList) {
+				// Whether it locks anything only a full scan can tell
+				rescan = true;
+				continue;
+			}
+
+			// Start is also reported when a process replaces its image
+			const PathId previous = entry.path;
+			const bool known = entry.resolved;
+
+			entry.resolved = false;
+			resolvePath(key, entry);
+
+			if (known && entry.path == previous) {
+				continue;
+			}
+
+			if (entry.process) {
+				exited.emplace_back(key);
+				entry.process.reset();
+			}
+
+			entry.matched = match(patterns->set, entry.path);
+			entry.patternGeneration = patterns->generation;
+
+			if (entry.matched) {
+				list.emplace_back(item(key, entry));
+			}
+		}
+
+		commit(list, exited, false);
+	}
+
+	if (!rescan) {
+		return true;
+	}
+
+	// The background thread scans when the schedule allows
+	if (m_running) {
+		m_scheduler.trigger();
+		return true;
+	}
+
+	return update();
+}
+
+void ProcessList::commit(const std::vector<ProcessListItem>& list, const std::vector<ProcessKey>& exited, bool complete)
+{
+	MetricsTimer timer(PhaseCommit);
+
+	auto guard = Metrics::lock(m_mutex);
+
+	std::vector<ProcessListItem> added;
+	std::vector<ProcessKey> removed;
+
+	// Remove terminated processes from map
+	for (auto& key : exited) {
+		if (m_processMap.erase(key)) {
+			removed.emplace_back(key);
+
+			if (m_exits) {
+				m_exits->unwatch(key);
+			}
+		}
+
+		m_exitedKeys.erase(key);
 	}
 
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	// Processes which stopped matching, after a pattern or a mode change
+	if (complete) {
+		m_listed.clear();
+
+		for (auto& p : list) {
+			m_listed.push_back(p->key());
+		}
+
+		std::sort(m_listed.begin(), m_listed.end());
+
+		for (auto it = m_processMap.begin(); it != m_processMap.end(); ) {
+			if (std::binary_search(m_listed.begin(), m_listed.end(), it->first)) {
+				++it;
+				continue;
+			}
+
+			removed.emplace_back(it->first);
 
-	// Add missing processes to process map by ID
+			if (m_exits) {
+				m_exits->unwatch(it->first);
+			}
+
+			it = m_processMap.erase(it);
+		}
+	}
+
+	// Add missing processes to process map
 	for (auto p : list) {
-		if (!m_processMap.count(p->id())) {
-			m_processMap[p->id()] = p;
+		// The exit watcher was faster than this poll
+		if (m_exitedKeys.count(p->key())) {
+			continue;
+		}
+
+		if (!m_processMap.count(p->key())) {
+			m_processMap[p->key()] = p;
+
+			added.emplace_back(p);
 
-			m_dirty = true;
+			if (m_exits) {
+				m_exits->watch(p->key());
+			}
 		}
 	}
 
-	// Remove terminated processes from map
-	std::vector<DWORD> ids_to_remove;
-	for (auto kv : m_processMap) {
-		if (!kv.second->running()) {
-			ids_to_remove.emplace_back(kv.first);
+	if (!added.empty() || !removed.empty()) {
+		publish(std::move(added), std::move(removed));
+	}
+}
+
+void ProcessList::onExit(const ProcessKey& key)
+{
+	auto guard = Metrics::lock(m_mutex);
+
+	// Kept until a poll or an event sees the exit too, so a poll which
+	// started before it cannot bring the process back
+	m_exitedKeys.insert(key);
+
+	if (m_processMap.erase(key)) {
+		publish({}, { key });
+	}
+}
+
+void ProcessList::publish(std::vector<ProcessListItem>&& added, std::vector<ProcessKey>&& removed)
+{
+	const auto previous = std::atomic_load(&m_published);
+
+	// The change record and the snapshot
+	Metrics::shared().add(CounterAllocations, 2);
+
+	auto change = std::make_shared<ProcessListChange>();
+	change->version = previous->version + 1;
+	change->added = std::move(added);
+	change->removed = std::move(removed);
+
+	auto next = std::make_shared<ProcessListSnapshot>();
+
+	next->version = change->version;
+	next->processes.reserve(m_processMap.size());
+
+	for (auto& kv : m_processMap) {
+		next->processes.emplace_back(kv.second);
+	}
+
+	// The log only holds pointers, carrying it forward is cheap
+	const size_t keep = (std::min)(previous->log.size(), ChangeLogLength - 1);
+
+	next->log.reserve(keep + 1);
+	next->log.assign(previous->log.end() - keep, previous->log.end());
+	next->log.emplace_back(std::move(change));
+
+	std::atomic_store(&m_published, ProcessListSnapshotPtr(std::move(next)));
+}
+
+bool ProcessList::refreshProcessCache(std::vector<ProcessKey>& exited)
+{
+	m_snapshot.clear();
+	m_scanParents.clear();
+
+	{
+		MetricsTimer timer(PhaseSnapshot);
+
+		if (!m_source->snapshot(m_snapshot, m_scanParents)) {
+			return false;
 		}
 	}
 
-	for (auto pid : ids_to_remove) {
-		m_processMap.erase(pid);
+	++m_pollCount;
 
-		m_dirty = true;
+	for (auto& key : m_snapshot) {
+		m_processCache[key].lastSeen = m_pollCount;
+	}
+
+	// Forget processes which exited
+	for (auto it = m_processCache.begin(); it != m_processCache.end(); ) {
+		if (it->second.lastSeen != m_pollCount) {
+			exited.emplace_back(it->first);
+			it = m_processCache.erase(it);
+		}
+		else {
+			++it;
+		}
 	}
 
 	return true;
 }
 
+void ProcessList::resolvePath(const ProcessKey& key, CachedProcess& entry)
+{
+	if (!entry.resolved) {
+		MetricsTimer timer(PhaseImagePath);
+		Metrics::shared().add(CounterProcessesOpened);
+
+		// The only time the source is asked about this process
+		m_source->imagePath(key, entry.path);
+		entry.resolved = true;
+	}
+}
+
+ProcessListItem ProcessList::item(const ProcessKey& key, CachedProcess& entry)
+{
+	if (!entry.process) {
+		resolvePath(key, entry);
+		entry.process = std::make_shared<Process>(key, entry.path);
+
+		Metrics::shared().add(CounterAllocations);
+	}
+
+	return entry.process;
+}
+
 bool ProcessList::getProcessList(std::vector<ProcessListItem>& list)
 {
-	if (m_mode == RestartManager)
+	const ProcessListMode mode = m_mode;
+
+	if (mode == RestartManager)
 		return getProcessListFromRestartManager(list);
+	else if (mode == OpenFiles)
+		return getProcessListFromOpenFiles(list);
+	else if (mode == Modules)
+		return getProcessListFromModules(list);
 	else
 		return getProcessListFromPsList(list);
 }
 
 bool ProcessList::getProcessListFromPsList(std::vector<ProcessListItem>& list)
 {
-	// Get process list
-	return Process::queryAllProcesses(list, [this](Process& p) {
-		return match(p.path());
-	});
+	const auto patterns = std::atomic_load(&m_patterns);
+
+	for (auto& kv : m_processCache) {
+		CachedProcess& entry = kv.second;
+
+		if (entry.patternGeneration != patterns->generation) {
+			resolvePath(kv.first, entry);
+
+			entry.matched = match(patterns->set, entry.path);
+			entry.patternGeneration = patterns->generation;
+		}
+
+		if (entry.matched) {
+			list.emplace_back(item(kv.first, entry));
+		}
+	}
+
+	return true;
 }
 
 bool ProcessList::getProcessListFromRestartManager(std::vector<ProcessListItem>& list)
 {
 	std::vector<std::wstring> lockedFiles;
 
-	std::vector<std::wstring> patternList;
+	const auto patterns = std::atomic_load(&m_patterns);
+
+	if (m_scannedPatternGeneration != patterns->generation) {
+		m_fileScanner.setPatterns(patterns->list);
+		m_scannedPatternGeneration = patterns->generation;
+	}
 
 	{
-		std::lock_guard<std::recursive_mutex> guard(m_mutex);
+		MetricsTimer timer(PhaseFileScan);
+
+		m_fileScanner.scan(lockedFiles);
+	}
+
+	m_scanKeys.clear();
 
-		patternList = m_patternList;
+	if (!m_source->lockers(lockedFiles, m_scanKeys)) {
+		return false;
 	}
 
-	for (auto& pattern : patternList) {
-		auto full = std::filesystem::absolute(pattern);
-		std::wstring filename = full.filename().wstring();
-		std::wstring parentDir = full.parent_path().wstring();
+	// Only lockers are resolved, and each of them once
+	for (auto& key : m_scanKeys) {
+		auto it = m_processCache.find(key);
+
+		// Started after the snapshot, picked up by the next poll
+		if (it == m_processCache.end()) {
+			continue;
+		}
 
-		GetFilesByWildcard(parentDir, filename, lockedFiles);
+		list.emplace_back(item(key, it->second));
 	}
 
-	return Process::queryAllProcesses(lockedFiles, list);
+	return true;
 }
 
-void ProcessList::thread(ProcessList* self)
+bool ProcessList::getProcessListFromOpenFiles(std::vector<ProcessListItem>& list)
 {
+	const auto patterns = std::atomic_load(&m_patterns);
+
+	if (patterns->set.empty()) {
+		return true;
+	}
+
+	m_scanKeys.clear();
+
+	// Matched against the same compiled set as image paths, no file
+	// system scan needed
 	{
-		// Warmup after initial update()
+		MetricsTimer timer(PhaseOpenFiles);
+
+		if (!m_source->fileHolders(m_snapshot, patterns->set, m_scanKeys)) {
+			return false;
+		}
+	}
+
+	for (auto& key : m_scanKeys) {
+		auto it = m_processCache.find(key);
+
+		if (it == m_processCache.end()) {
+			continue;
+		}
+
+		list.emplace_back(item(key, it->second));
+	}
+
+	return true;
+}
+
+bool ProcessList::getProcessListFromModules(std::vector<ProcessListItem>& list)
+{
+	const auto patterns = std::atomic_load(&m_patterns);
+
+	for (auto& kv : m_processCache) {
+		CachedProcess& entry = kv.second;
+
+		uint64_t signature;
 
-		std::unique_lock<std::mutex> lock(self->m_event_mutex);
-		std::cv_status status = self->m_event.wait_for(lock, std::chrono::milliseconds(5000));
+		Metrics::shared().add(CounterProcessesOpened);
+
+		// Other users' processes and system processes cannot be read
+		if (!m_source->moduleSignature(kv.first, signature)) {
+			continue;
+		}
+
+		if (!entry.modulesRead || entry.moduleSignature != signature) {
+			MetricsTimer timer(PhaseModules);
+
+			entry.modules.clear();
+			entry.modulesRead = m_source->modules(kv.first, entry.modules);
+			entry.moduleSignature = signature;
+			entry.modulePatternGeneration = (size_t)-1;
+		}
+
+		if (entry.modulePatternGeneration != patterns->generation) {
+			entry.modulesMatched = false;
+
+			for (auto module : entry.modules) {
+				if (match(patterns->set, module)) {
+					entry.modulesMatched = true;
+					break;
+				}
+			}
+
+			entry.modulePatternGeneration = patterns->generation;
+		}
+
+		if (entry.modulesMatched) {
+			list.emplace_back(item(kv.first, entry));
+		}
 	}
 
+	return true;
+}
+
+void ProcessList::thread(ProcessList* self)
+{
+	Trace::nameThread("scan");
+
+	// Warmup: the owner scans, or requests a scan, when it adds patterns.
+	// The scheduler's warmup delays the first scan of its own.
+	std::vector<ProcessEvent> events;
+
 	while (self->m_running) {
-		auto start = std::chrono::system_clock::now();
-		self->update();
-		auto end = std::chrono::system_clock::now();
+		{
+			std::unique_lock<std::mutex> lock(self->m_pauseMutex);
 
-		std::chrono::milliseconds msec =
-			std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+			if (self->m_paused) {
+				self->m_pauseEvent.wait(lock, [self] { return !self->m_paused || !self->m_running; });
+				continue;
+			}
+		}
+
+		if (self->m_scheduler.due()) {
+			self->update();
 
-		msec *= 5;
+			// With live events a full poll is only a consistency sweep.
+			// The other modes keep polling: a running process opening a
+			// file raises no event.
+			if (self->m_events->live() && self->m_mode == PsList) {
+				self->m_scheduler.postpone(std::chrono::steady_clock::now() +
+					std::chrono::milliseconds(SweepIntervalMilliseconds));
+			}
+		}
 
-		if (msec.count() > 10000)
-			msec = std::chrono::milliseconds(10000);
-		else if (msec.count() < 1000)
-			msec = std::chrono::milliseconds(1000);
+		events.clear();
 
-		std::unique_lock<std::mutex> lock(self->m_event_mutex);
-		std::cv_status status = self->m_event.wait_for(lock, msec);
+		if (!self->m_events->wait(self->m_scheduler.untilNext(), events)) {
+			// Events were lost, only a full poll can catch up
+			self->m_scheduler.rescanNow();
+		}
+		else if (!events.empty() && self->m_running) {
+			self->handleEvents(events);
+		}
 	}
 
 	std::unique_lock<std::mutex> lock(self->m_exit_event_mutex);
+	self->m_exited = true;
 	self->m_exit_event.notify_one();
 }
 
-bool ProcessList::changed()
+ProcessListSnapshotPtr ProcessList::snapshot() const
 {
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	return std::atomic_load(&m_published);
+}
+
+ProcessListDelta ProcessList::diffSince(size_t generation) const
+{
+	const auto current = snapshot();
+
+	ProcessListDelta delta;
+	delta.generation = current->version;
+
+	if (generation == current->version) {
+		return delta;
+	}
+
+	// Older than the log reaches, or not ours at all
+	const bool covered = generation < current->version &&
+		!current->log.empty() && current->log.front()->version <= generation + 1;
+
+	if (covered) {
+		std::map<ProcessKey, ProcessListItem> added;
+		std::set<ProcessKey> removed;
+
+		for (auto& change : current->log) {
+			if (change->version <= generation) {
+				continue;
+			}
+
+			// Added and removed again since generation: the consumer never
+			// saw it
+			for (auto& key : change->removed) {
+				if (!added.erase(key)) {
+					removed.insert(key);
+				}
+			}
+
+			for (auto& p : change->added) {
+				added[p->key()] = p;
+			}
+		}
+
+		// Compaction: past the size of the list itself a full list is
+		// cheaper to apply
+		if (added.size() + removed.size() <= current->processes.size()) {
+			delta.removed.assign(removed.begin(), removed.end());
+			delta.added.reserve(added.size());
+
+			for (auto& kv : added) {
+				delta.added.emplace_back(kv.second);
+			}
+
+			return delta;
+		}
+	}
 
-	return m_dirty;
+	delta.reset = true;
+	delta.added = current->processes;
+
+	return delta;
+}
+
+bool ProcessList::changed()
+{
+	return snapshot()->version != m_filledVersion;
 }
 
 void ProcessList::fill(std::vector<ProcessListItem>& output)
 {
-	std::lock_guard<std::recursive_mutex> guard(m_mutex);
+	TraceSpan span("fill", "ui");
 
-	for (auto kv : m_processMap) {
-		output.emplace_back(kv.second);
-	}
+	auto current = snapshot();
+
+	output.insert(output.end(), current->processes.begin(), current->processes.end());
 
-	m_dirty = false;
+	m_filledVersion = current->version;
 }
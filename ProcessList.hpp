@@ -1,56 +1,252 @@
 #pragma once
 
 #include "Process.hpp"
+#include "ProcessSource.hpp"
+#include "ProcessEventSource.hpp"
+#include "ExitWatcher.hpp"
+#include "PatternSet.hpp"
+#include "FileScanner.hpp"
+#include "RescanScheduler.hpp"
 
 #include <vector>
 #include <map>
+#include <set>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
+#include <atomic>
 
 typedef std::shared_ptr<Process> ProcessListItem;
 
+// What one publication changed: processes added and removed to get from
+// version - 1 to version
+struct ProcessListChange
+{
+	size_t version = 0;
+	std::vector<ProcessListItem> added;
+	std::vector<ProcessKey> removed;
+};
+
+// The listed processes at one point in time. Never modified once
+// published; every change publishes a new snapshot with a higher version.
+struct ProcessListSnapshot
+{
+	size_t version = 0;
+	std::vector<ProcessListItem> processes;
+
+	// The changes which led here, oldest first, at most
+	// ProcessList::ChangeLogLength of them
+	std::vector<std::shared_ptr<const ProcessListChange>> log;
+};
+
+// Net changes between two versions. Consumers apply removed before added.
+// When reset is set the consumer fell too far behind: added then holds
+// the whole list and everything it had before is to be dropped.
+struct ProcessListDelta
+{
+	size_t generation = 0;
+	bool reset = false;
+	std::vector<ProcessListItem> added;
+	std::vector<ProcessKey> removed;
+};
+
+typedef std::shared_ptr<const ProcessListSnapshot> ProcessListSnapshotPtr;
+
 enum ProcessListMode
 {
 	PsList,
-	RestartManager
+	RestartManager,
+	OpenFiles,
+	Modules
 };
 
 class ProcessList
 {
 public:
-	ProcessList(ProcessListMode mode);
+	// Changes a consumer can lag behind before it gets a full list again
+	static const size_t ChangeLogLength = 64;
+
+	ProcessList(ProcessListMode mode) : ProcessList(mode, ProcessSource::create(), true, ProcessEventSource::create()) {}
+	// Without a background thread the owner calls update() itself. Without
+	// an event source the background thread only polls.
+	ProcessList(ProcessListMode mode, std::unique_ptr<ProcessSource> source, bool background = true,
+		std::unique_ptr<ProcessEventSource> events = nullptr);
 	~ProcessList();
 
-	void addPatterns(const std::vector<std::wstring>& patterns);
-	void addPattern(const TCHAR* pattern);
+	// One scan without the dialog's machinery: no background thread, no
+	// process events, no exit watcher. For silent installs and the CLI.
+	static bool query(ProcessListMode mode, const std::vector<std::wstring>& patterns,
+		std::vector<ProcessListItem>& output);
+
+	// Polls the source once
+	bool update();
+
+	// Applies process start and exit events without a full poll
+	bool handleEvents(const std::vector<ProcessEvent>& events);
+
+	// Scans right away, or on a worker thread when wait is false
+	void addPatterns(const std::vector<std::wstring>& patterns, bool wait = true);
+	void addPattern(const std::wstring& pattern);
+
+	// Takes effect with the next scan, which unlists the processes the new
+	// mode does not report
+	void setMode(ProcessListMode mode);
+
+	// Scans on a worker thread and returns at once. Requests made while
+	// the worker scans are folded into one more scan.
+	void requestUpdate();
+
+	// Blocks until every scan requested so far has been published
+	void waitForUpdate();
+
+	// Idles the background thread until resume(): it neither scans nor
+	// reads process events, so an installer writing files is left alone.
+	// Scans the owner runs or requests still happen. resume() returns
+	// whether the thread was paused, and its list may be stale.
+	void pause();
+	bool resume();
+
+	// When the background thread scans. The default polls adaptively,
+	// five times the last scan's duration within 1 to 10 seconds; process
+	// starts in modes other than PsList trigger a scan. The thread picks
+	// a new policy up when its current wait ends.
+	void setSchedule(const RescanPolicy& policy);
+
+	// Latest snapshot. Swapped in atomically by the scanner, so readers
+	// never wait for a scan and a scan never waits for readers.
+	ProcessListSnapshotPtr snapshot() const;
 
+	// What changed since the caller's generation, which is 0 or the
+	// generation of an earlier delta. O(changes) unless the result is a
+	// reset.
+	ProcessListDelta diffSince(size_t generation) const;
+
+	// Whether a snapshot newer than the one last passed to fill() exists
 	bool changed();
 	void fill(std::vector<ProcessListItem>& output);
 
 private:
-	bool match(const TCHAR* path);
-	bool update();
+	// What the process cache remembers about every running process
+	struct CachedProcess
+	{
+		PathId path = InvalidPathId;
+		bool resolved = false;
+		bool matched = false;
+		size_t patternGeneration = (size_t)-1;
+		size_t lastSeen = 0;
+		ProcessListItem process;
+
+		// Modules mode: mapped images, read again only when the source
+		// reports a different signature
+		bool modulesRead = false;
+		uint64_t moduleSignature = 0;
+		std::vector<PathId> modules;
+		bool modulesMatched = false;
+		size_t modulePatternGeneration = (size_t)-1;
+	};
+
+	// Patterns are published like snapshots, a scan uses the set it
+	// loaded when it started
+	struct Patterns
+	{
+		std::vector<std::wstring> list;
+		PatternSet set;
+		size_t generation = 0;
+	};
+
+	static bool match(const PatternSet& patterns, const PathId path);
+
+	void storePatterns(const std::vector<std::wstring>& patterns);
+
+	bool refreshProcessCache(std::vector<ProcessKey>& exited);
+	void resolvePath(const ProcessKey& key, CachedProcess& entry);
+	// A complete list, from a full scan, also unlists every process it
+	// does not hold
+	void commit(const std::vector<ProcessListItem>& list, const std::vector<ProcessKey>& exited, bool complete);
+	void onExit(const ProcessKey& key);
+	void publish(std::vector<ProcessListItem>&& added, std::vector<ProcessKey>&& removed);
+	ProcessListItem item(const ProcessKey& key, CachedProcess& entry);
 
 	bool getProcessList(std::vector<ProcessListItem>& list);
 	bool getProcessListFromPsList(std::vector<ProcessListItem>& list);
 	bool getProcessListFromRestartManager(std::vector<ProcessListItem>& list);
+	bool getProcessListFromOpenFiles(std::vector<ProcessListItem>& list);
+	bool getProcessListFromModules(std::vector<ProcessListItem>& list);
 
 	static void thread(ProcessList* self);
+	void scanRequested();
 
 private:
-	bool m_dirty;
-	std::map<DWORD, ProcessListItem> m_processMap;
-	std::vector<std::wstring> m_patternList;
-	std::recursive_mutex m_mutex;
+	// Writers only: serializes pattern changes
+	std::mutex m_patternMutex;
+	std::shared_ptr<const Patterns> m_patterns;
+
+	ProcessListSnapshotPtr m_published;
+	std::atomic<size_t> m_filledVersion{ 0 };
+
+	// Serializes update(), which owns the source and the caches below, and
+	// its commit. Taken before m_mutex.
+	std::mutex m_scanMutex;
+	std::unique_ptr<ProcessSource> m_source;
+
+	// Every running process as of the last poll, so only new ones get
+	// resolved and exits are noticed without querying each process
+	std::map<ProcessKey, CachedProcess> m_processCache;
+	std::vector<ProcessKey> m_snapshot;
+
+	// Per-scan buffers, kept so a poll which changes nothing allocates
+	// nothing. Parents only matter to Terminator, which takes its own
+	// snapshot at the moment it terminates.
+	std::vector<ProcessId> m_scanParents;
+	std::vector<ProcessListItem> m_scanList;
+	std::vector<ProcessKey> m_scanExited;
+	std::vector<ProcessKey> m_scanKeys;
+	size_t m_pollCount = 0;
+
+	// RestartManager mode: cached, watched file set
+	FileScanner m_fileScanner;
+	size_t m_scannedPatternGeneration = 0;
+
+	// Writers only: guards the process map and publication
+	std::mutex m_mutex;
+	std::map<ProcessKey, ProcessListItem> m_processMap;
+
+	// Keys of a complete list, sorted, reused by every commit
+	std::vector<ProcessKey> m_listed;
+
 	std::thread m_thread;
-	
-	std::condition_variable m_event;
-	std::mutex m_event_mutex;
+
+	// Told about every scan, whoever ran it
+	RescanScheduler m_scheduler;
+
+	// Wakes the thread on process events and on shutdown
+	std::unique_ptr<ProcessEventSource> m_events;
 
 	std::condition_variable m_exit_event;
 	std::mutex m_exit_event_mutex;
+	bool m_exited = false;
+
+	std::atomic<bool> m_running;
+
+	// Holds the background thread between pause() and resume()
+	std::mutex m_pauseMutex;
+	std::condition_variable m_pauseEvent;
+	bool m_paused = false;
+
+	std::atomic<ProcessListMode> m_mode;
+
+	// Scans requested and completed by the worker
+	std::mutex m_requestMutex;
+	std::condition_variable m_requestEvent;
+	size_t m_requested = 0;
+	size_t m_completed = 0;
+	bool m_scanning = false;
+	std::thread m_requestThread;
 
-	bool m_running;
+	// Exits reported by the watcher but not yet by a poll or an event
+	std::set<ProcessKey> m_exitedKeys;
 
-	ProcessListMode m_mode;
+	// Removes listed processes the moment they exit. Declared last: its
+	// callbacks use the members above.
+	std::unique_ptr<ExitWatcher> m_exits;
 };
@@ -0,0 +1,1020 @@
+#include "stdafx.h"
+#include "ProcessSource.hpp"
+#include "LockerQuery.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <set>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winternl.h>
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+#elif defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+// Runs fn(i) for every i below count on a few threads. Each thread takes
+// the next index when done with its last, per-process work varies a lot.
+static void parallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+	const size_t ItemsPerThread = 16;
+	const size_t MaxThreads = 8;
+
+	size_t threadCount = (std::min)((size_t)std::thread::hardware_concurrency(), MaxThreads);
+	threadCount = (std::min)(threadCount, count / ItemsPerThread);
+
+	std::atomic<size_t> next(0);
+
+	auto run = [&] {
+		for (size_t i = next++; i < count; i = next++) {
+			fn(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (size_t i = 1; i < threadCount; ++i) {
+		threads.emplace_back(run);
+	}
+
+	run();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+#ifdef _WIN32
+
+// SYSTEM_PROCESS_INFORMATION as returned by NtQuerySystemInformation;
+// winternl.h hides the fields we need behind Reserved members.
+struct SystemProcessInformation
+{
+	ULONG NextEntryOffset;
+	ULONG NumberOfThreads;
+	LARGE_INTEGER WorkingSetPrivateSize;
+	ULONG HardFaultCount;
+	ULONG NumberOfThreadsHighWatermark;
+	ULONGLONG CycleTime;
+	LARGE_INTEGER CreateTime;
+	LARGE_INTEGER UserTime;
+	LARGE_INTEGER KernelTime;
+	UNICODE_STRING ImageName;
+	LONG BasePriority;
+	HANDLE UniqueProcessId;
+	HANDLE InheritedFromUniqueProcessId;
+};
+
+// SYSTEM_HANDLE_INFORMATION_EX and its entries
+struct SystemHandleEntry
+{
+	PVOID Object;
+	ULONG_PTR UniqueProcessId;
+	ULONG_PTR HandleValue;
+	ULONG GrantedAccess;
+	USHORT CreatorBackTraceIndex;
+	USHORT ObjectTypeIndex;
+	ULONG HandleAttributes;
+	ULONG Reserved;
+};
+
+struct SystemHandleInformation
+{
+	ULONG_PTR NumberOfHandles;
+	ULONG_PTR Reserved;
+	SystemHandleEntry Handles[1];
+};
+
+typedef NTSTATUS(NTAPI* NtQuerySystemInformationFn)(ULONG, PVOID, ULONG, PULONG);
+
+static const ULONG SystemProcessInformationClass = 5;
+static const ULONG SystemExtendedHandleInformationClass = 64;
+static const NTSTATUS StatusInfoLengthMismatch = (NTSTATUS)0xC0000004L;
+
+static ULONGLONG toULongLong(const FILETIME& ft)
+{
+	return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+// Calls NtQuerySystemInformation with a buffer grown until the result fits
+static bool querySystemInformation(ULONG infoClass, std::vector<BYTE>& buf)
+{
+	static const NtQuerySystemInformationFn ntQuerySystemInformation =
+		(NtQuerySystemInformationFn)GetProcAddress(GetModuleHandle(TEXT("ntdll.dll")), "NtQuerySystemInformation");
+
+	if (!ntQuerySystemInformation) {
+		return false;
+	}
+
+	NTSTATUS status;
+	ULONG bufNeeded = 0;
+
+	while ((status = ntQuerySystemInformation(
+		infoClass,
+		buf.data(),
+		(ULONG)buf.size(),
+		&bufNeeded)) == StatusInfoLengthMismatch) {
+		buf.resize((std::max)((size_t)bufNeeded, buf.size()) + 64 * 1024);
+	}
+
+	return status >= 0;
+}
+
+// Process table from a single NtQuerySystemInformation call, lockers from
+// sharded Restart Manager sessions, open files from the system handle
+// table
+class Win32ProcessSource : public ProcessSource
+{
+public:
+	~Win32ProcessSource()
+	{
+		if (m_probe != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_probe);
+		}
+	}
+
+	bool snapshot(std::vector<ProcessKey>& output, std::vector<ProcessId>& parents) override
+	{
+		// Reused between calls, the process table only ever needs a few
+		// hundred KB and regrowing it every poll is pointless.
+		thread_local std::vector<BYTE> buf(256 * 1024);
+
+		if (!querySystemInformation(SystemProcessInformationClass, buf)) {
+			return false;
+		}
+
+		const BYTE* pos = buf.data();
+
+		for (;;) {
+			auto info = (const SystemProcessInformation*)pos;
+
+			output.push_back({
+				(ProcessId)(ULONG_PTR)info->UniqueProcessId,
+				(uint64_t)info->CreateTime.QuadPart });
+			parents.push_back((ProcessId)(ULONG_PTR)info->InheritedFromUniqueProcessId);
+
+			if (!info->NextEntryOffset) {
+				break;
+			}
+
+			pos += info->NextEntryOffset;
+		}
+
+		return true;
+	}
+
+	bool key(ProcessId id, ProcessKey& key) override
+	{
+		HANDLE handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, id);
+
+		if (!handle) {
+			return false;
+		}
+
+		FILETIME creation, exit, kernel, user;
+		bool result = GetProcessTimes(handle, &creation, &exit, &kernel, &user) != FALSE;
+
+		if (result) {
+			key = { id, toULongLong(creation) };
+		}
+
+		CloseHandle(handle);
+
+		return result;
+	}
+
+	bool imagePath(const ProcessKey& key, PathId& path) override
+	{
+		HANDLE handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, key.id);
+
+		if (!handle) {
+			return false;
+		}
+
+		bool result = false;
+
+		FILETIME creation, exit, kernel, user;
+		if (GetProcessTimes(handle, &creation, &exit, &kernel, &user) &&
+			toULongLong(creation) == key.startTime) {
+			// Per-thread scratch buffer, nothing is allocated unless the
+			// path is new to the PathStore
+			thread_local std::vector<WCHAR> scratch(32768);
+
+			DWORD bufLen = (DWORD)scratch.size();
+
+			if (QueryFullProcessImageNameW(handle, 0, scratch.data(), &bufLen)) {
+				path = PathStore::shared().intern(scratch.data(), bufLen);
+				result = path != InvalidPathId;
+			}
+		}
+
+		CloseHandle(handle);
+
+		return result;
+	}
+
+	bool lockers(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output) override
+	{
+		// Its worker threads are only needed in Restart Manager mode
+		if (!m_lockers) {
+			m_lockers = std::make_unique<LockerQuery>(RestartManagerBackend::create());
+		}
+
+		return m_lockers->query(files, output);
+	}
+
+	bool fileHolders(const std::vector<ProcessKey>& processes, const PatternSet& patterns,
+		std::vector<ProcessKey>& output) override
+	{
+		// Tens of thousands of handles, several MB
+		thread_local std::vector<BYTE> buf(4 * 1024 * 1024);
+
+		if (!probe() || !querySystemInformation(SystemExtendedHandleInformationClass, buf)) {
+			return false;
+		}
+
+		auto table = (const SystemHandleInformation*)buf.data();
+
+		if (!m_fileTypeKnown) {
+			// Type indices differ between Windows versions, the index of
+			// our own file handle is the one of every file
+			for (ULONG_PTR i = 0; i < table->NumberOfHandles; ++i) {
+				auto& entry = table->Handles[i];
+
+				if (entry.UniqueProcessId == GetCurrentProcessId() && entry.HandleValue == (ULONG_PTR)m_probe) {
+					m_fileType = entry.ObjectTypeIndex;
+					m_fileTypeKnown = true;
+					break;
+				}
+			}
+
+			if (!m_fileTypeKnown) {
+				return false;
+			}
+		}
+
+		std::map<ProcessId, size_t> indices;
+
+		for (size_t i = 0; i < processes.size(); ++i) {
+			if (processes[i].id != GetCurrentProcessId()) {
+				indices[processes[i].id] = i;
+			}
+		}
+
+		std::vector<std::vector<HANDLE>> handles(processes.size());
+
+		for (ULONG_PTR i = 0; i < table->NumberOfHandles; ++i) {
+			auto& entry = table->Handles[i];
+
+			if (entry.ObjectTypeIndex != m_fileType) {
+				continue;
+			}
+
+			auto it = indices.find((ProcessId)entry.UniqueProcessId);
+
+			if (it != indices.end()) {
+				handles[it->second].push_back((HANDLE)entry.HandleValue);
+			}
+		}
+
+		std::vector<char> holds(processes.size(), 0);
+
+		parallelFor(processes.size(), [&](size_t i) {
+			if (!handles[i].empty()) {
+				holds[i] = holdsMatchingFile(processes[i], handles[i], patterns);
+			}
+		});
+
+		for (size_t i = 0; i < processes.size(); ++i) {
+			if (holds[i]) {
+				output.push_back(processes[i]);
+			}
+		}
+
+		return true;
+	}
+
+	// A 32-bit process cannot enumerate the modules of a 64-bit one, those
+	// fail and are left to the other modes
+	bool moduleSignature(const ProcessKey& key, uint64_t& signature) override
+	{
+		HANDLE process = openProcess(key, PROCESS_QUERY_INFORMATION | PROCESS_VM_READ);
+
+		if (!process) {
+			return false;
+		}
+
+		DWORD needed = 0;
+		bool result = EnumProcessModulesEx(process, NULL, 0, &needed, LIST_MODULES_ALL) != FALSE;
+
+		if (result) {
+			signature = needed / sizeof(HMODULE);
+		}
+
+		CloseHandle(process);
+
+		return result;
+	}
+
+	bool modules(const ProcessKey& key, std::vector<PathId>& output) override
+	{
+		HANDLE process = openProcess(key, PROCESS_QUERY_INFORMATION | PROCESS_VM_READ);
+
+		if (!process) {
+			return false;
+		}
+
+		std::vector<HMODULE> handles(256);
+		DWORD needed = 0;
+		bool result;
+
+		// Modules may be loaded between the two calls
+		while ((result = EnumProcessModulesEx(process, handles.data(), (DWORD)(handles.size() * sizeof(HMODULE)),
+			&needed, LIST_MODULES_ALL) != FALSE) && needed > handles.size() * sizeof(HMODULE)) {
+			handles.resize(needed / sizeof(HMODULE) + 16);
+		}
+
+		if (result) {
+			thread_local std::vector<WCHAR> scratch(32768);
+
+			for (size_t i = 0; i < needed / sizeof(HMODULE); ++i) {
+				DWORD len = GetModuleFileNameExW(process, handles[i], scratch.data(), (DWORD)scratch.size());
+
+				if (len && len < scratch.size()) {
+					output.push_back(PathStore::shared().intern(scratch.data(), len));
+				}
+			}
+		}
+
+		CloseHandle(process);
+
+		return result;
+	}
+
+private:
+	// Opens a process, failing if its PID now belongs to another one
+	static HANDLE openProcess(const ProcessKey& key, DWORD access)
+	{
+		HANDLE process = OpenProcess(access, FALSE, key.id);
+
+		if (!process) {
+			return NULL;
+		}
+
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(process, &creation, &exit, &kernel, &user) ||
+			toULongLong(creation) != key.startTime) {
+			CloseHandle(process);
+			return NULL;
+		}
+
+		return process;
+	}
+
+	// A file handle of our own, to find out the type index of files
+	bool probe()
+	{
+		if (m_probe == INVALID_HANDLE_VALUE) {
+			WCHAR path[MAX_PATH];
+			DWORD len = GetModuleFileNameW(NULL, path, MAX_PATH);
+
+			if (!len || len >= MAX_PATH) {
+				return false;
+			}
+
+			m_probe = CreateFileW(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				NULL, OPEN_EXISTING, 0, NULL);
+		}
+
+		return m_probe != INVALID_HANDLE_VALUE;
+	}
+
+	static bool holdsMatchingFile(const ProcessKey& key, const std::vector<HANDLE>& handles, const PatternSet& patterns)
+	{
+		HANDLE process = OpenProcess(PROCESS_DUP_HANDLE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, key.id);
+
+		if (!process) {
+			return false;
+		}
+
+		bool result = false;
+
+		FILETIME creation, exit, kernel, user;
+		if (GetProcessTimes(process, &creation, &exit, &kernel, &user) &&
+			toULongLong(creation) == key.startTime) {
+			thread_local std::vector<WCHAR> scratch(32768);
+
+			for (size_t i = 0; i < handles.size() && !result; ++i) {
+				HANDLE handle;
+
+				if (!DuplicateHandle(process, handles[i], GetCurrentProcess(), &handle, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+					continue;
+				}
+
+				// Pipes and devices are skipped first: asking a pipe for its
+				// name can block forever
+				if (GetFileType(handle) == FILE_TYPE_DISK) {
+					DWORD len = GetFinalPathNameByHandleW(handle, scratch.data(), (DWORD)scratch.size(),
+						FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+
+					if (len && len < scratch.size()) {
+						const WCHAR* path = scratch.data();
+
+						// \\?\C:\... to C:\..., \\?\UNC\server\... to \\server\...
+						if (len >= 8 && wcsncmp(path, L"\\\\?\\UNC\\", 8) == 0) {
+							scratch[6] = L'\\';
+							path += 6;
+							len -= 6;
+						}
+						else if (len >= 4 && wcsncmp(path, L"\\\\?\\", 4) == 0) {
+							path += 4;
+							len -= 4;
+						}
+
+						result = patterns.match(path, len);
+					}
+				}
+
+				CloseHandle(handle);
+			}
+		}
+
+		CloseHandle(process);
+
+		return result;
+	}
+
+private:
+	std::unique_ptr<LockerQuery> m_lockers;
+
+	HANDLE m_probe = INVALID_HANDLE_VALUE;
+	bool m_fileTypeKnown = false;
+	USHORT m_fileType = 0;
+};
+
+#elif defined(__linux__)
+
+// Process table from /proc. The start time comes from field 22 of
+// /proc/<pid>/stat, the image path from the /proc/<pid>/exe link.
+class ProcProcessSource : public ProcessSource
+{
+public:
+	ProcProcessSource()
+	{
+		m_proc = opendir("/proc");
+	}
+
+	~ProcProcessSource()
+	{
+		if (m_proc) {
+			closedir(m_proc);
+		}
+	}
+
+	bool snapshot(std::vector<ProcessKey>& output, std::vector<ProcessId>& parents) override
+	{
+		if (!m_proc) {
+			return false;
+		}
+
+		rewinddir(m_proc);
+
+		while (dirent* entry = readdir(m_proc)) {
+			char* end;
+			unsigned long id = strtoul(entry->d_name, &end, 10);
+
+			if (*end || end == entry->d_name) {
+				continue;
+			}
+
+			uint64_t startTime;
+			ProcessId parent;
+
+			// Exited between readdir() and here
+			if (!readStat((ProcessId)id, startTime, &parent)) {
+				continue;
+			}
+
+			output.push_back({ (ProcessId)id, startTime });
+			parents.push_back(parent);
+		}
+
+		return true;
+	}
+
+	bool key(ProcessId id, ProcessKey& key) override
+	{
+		uint64_t startTime;
+
+		if (!m_proc || !readStartTime(id, startTime)) {
+			return false;
+		}
+
+		key = { id, startTime };
+
+		return true;
+	}
+
+	bool imagePath(const ProcessKey& key, PathId& path) override
+	{
+		uint64_t startTime;
+
+		if (!readStartTime(key.id, startTime) || startTime != key.startTime) {
+			return false;
+		}
+
+		char link[32];
+		snprintf(link, sizeof(link), "/proc/%u/exe", key.id);
+
+		// Per-thread scratch buffers, nothing is allocated unless the path
+		// is new to the PathStore
+		thread_local std::vector<char> target(4096);
+		thread_local std::vector<wchar_t> wide(4096);
+
+		ssize_t len = readlink(link, target.data(), target.size());
+
+		// Kernel threads have no image
+		if (len <= 0 || (size_t)len >= target.size()) {
+			return false;
+		}
+
+		size_t wideLen = decodeUtf8(target.data(), (size_t)len, wide.data());
+		path = PathStore::shared().intern(wide.data(), wideLen);
+
+		return path != InvalidPathId;
+	}
+
+	bool lockers(const std::vector<std::wstring>&, std::vector<ProcessKey>&) override
+	{
+		// No Restart Manager equivalent
+		return false;
+	}
+
+	bool fileHolders(const std::vector<ProcessKey>& processes, const PatternSet& patterns,
+		std::vector<ProcessKey>& output) override
+	{
+		if (!m_proc) {
+			return false;
+		}
+
+		std::vector<char> holds(processes.size(), 0);
+
+		parallelFor(processes.size(), [&](size_t i) {
+			holds[i] = processes[i].id != (ProcessId)getpid() && holdsMatchingFile(processes[i], patterns);
+		});
+
+		for (size_t i = 0; i < processes.size(); ++i) {
+			if (holds[i]) {
+				output.push_back(processes[i]);
+			}
+		}
+
+		return true;
+	}
+
+	bool moduleSignature(const ProcessKey& key, uint64_t& signature) override
+	{
+		// The size of the executable library mappings changes as modules
+		// are loaded and unloaded, and takes one short read of the status
+		// file instead of the whole maps file
+		thread_local std::vector<char> buf;
+
+		if (!readProcFile(key, "status", buf)) {
+			return false;
+		}
+
+		static const char field[] = "\nVmLib:";
+
+		buf.push_back('\0');
+
+		// Processes without an address space have no VmLib
+		const char* value = strstr(buf.data(), field);
+		signature = value ? strtoull(value + sizeof(field) - 1, nullptr, 10) : 0;
+
+		return true;
+	}
+
+	bool modules(const ProcessKey& key, std::vector<PathId>& output) override
+	{
+		thread_local std::vector<char> buf;
+		thread_local std::vector<wchar_t> wide(4096);
+
+		if (!readProcFile(key, "maps", buf)) {
+			return false;
+		}
+
+		const size_t first = output.size();
+
+		// address perms offset dev inode path, the path is the only field
+		// starting with '/'. Anonymous mappings have none.
+		for (size_t pos = 0; pos < buf.size(); ) {
+			const char* line = buf.data() + pos;
+			const char* end = (const char*)memchr(line, '\n', buf.size() - pos);
+			const size_t len = end ? (size_t)(end - line) : buf.size() - pos;
+
+			pos += len + 1;
+
+			const char* path = (const char*)memchr(line, '/', len);
+
+			if (!path) {
+				continue;
+			}
+
+			const size_t pathLen = len - (size_t)(path - line);
+
+			if (pathLen > wide.size()) {
+				continue;
+			}
+
+			size_t wideLen = decodeUtf8(path, pathLen, wide.data());
+			output.push_back(PathStore::shared().intern(wide.data(), wideLen));
+		}
+
+		// An image is mapped several times, once per segment
+		std::sort(output.begin() + first, output.end());
+		output.erase(std::unique(output.begin() + first, output.end()), output.end());
+
+		return true;
+	}
+
+private:
+	// Whole /proc/<pid>/<file>, if the PID still belongs to the process
+	bool readProcFile(const ProcessKey& key, const char* file, std::vector<char>& buf)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%u/%s", key.id, file);
+
+		int fd = openat(dirfd(m_proc), name, O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		buf.resize(64 * 1024);
+
+		size_t used = 0;
+		ssize_t len;
+
+		while ((len = read(fd, buf.data() + used, buf.size() - used)) > 0) {
+			used += (size_t)len;
+
+			if (used == buf.size()) {
+				buf.resize(buf.size() * 2);
+			}
+		}
+
+		close(fd);
+		buf.resize(used);
+
+		// Read after the file: it belonged to whatever had the PID
+		uint64_t startTime;
+
+		return len == 0 && readStartTime(key.id, startTime) && startTime == key.startTime;
+	}
+
+	// Only the processes of the same user can be read without privileges,
+	// like lsof
+	bool holdsMatchingFile(const ProcessKey& key, const PatternSet& patterns)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%u/fd", key.id);
+
+		int fd = openat(dirfd(m_proc), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		DIR* dir = fdopendir(fd);
+
+		if (!dir) {
+			close(fd);
+			return false;
+		}
+
+		thread_local std::vector<char> target(4096);
+		thread_local std::vector<wchar_t> wide(4096);
+
+		bool result = false;
+
+		while (dirent* entry = readdir(dir)) {
+			if (entry->d_name[0] == '.') {
+				continue;
+			}
+
+			ssize_t len = readlinkat(dirfd(dir), entry->d_name, target.data(), target.size());
+
+			// Sockets, pipes and anonymous inodes are not paths
+			if (len <= 0 || (size_t)len >= target.size() || target[0] != '/') {
+				continue;
+			}
+
+			size_t wideLen = decodeUtf8(target.data(), (size_t)len, wide.data());
+
+			if (patterns.match(wide.data(), wideLen)) {
+				result = true;
+				break;
+			}
+		}
+
+		closedir(dir);
+
+		// The descriptors belonged to whatever had the PID while they were
+		// read
+		uint64_t startTime;
+
+		return result && readStartTime(key.id, startTime) && startTime == key.startTime;
+	}
+
+	bool readStartTime(ProcessId id, uint64_t& startTime)
+	{
+		return readStat(id, startTime, nullptr);
+	}
+
+	// Start time and, if asked for, parent PID (field 4) from
+	// /proc/<pid>/stat
+	bool readStat(ProcessId id, uint64_t& startTime, ProcessId* parent)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%u/stat", id);
+
+		int fd = openat(dirfd(m_proc), name, O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		char buf[1024];
+		ssize_t len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+
+		if (len <= 0) {
+			return false;
+		}
+
+		buf[len] = 0;
+
+		// The command name in field 2 may contain spaces and parentheses,
+		// the fields after it start behind the last ')'
+		const char* pos = strrchr(buf, ')');
+
+		if (!pos) {
+			return false;
+		}
+
+		// Field 3 (state) follows, starttime is field 22
+		for (int field = 2; field < 22 && pos; ++field) {
+			pos = strchr(pos + 1, ' ');
+
+			// pos is the space in front of field + 1
+			if (field == 3 && pos && parent) {
+				*parent = (ProcessId)strtoul(pos + 1, nullptr, 10);
+			}
+		}
+
+		if (!pos) {
+			return false;
+		}
+
+		startTime = strtoull(pos + 1, nullptr, 10);
+
+		return true;
+	}
+
+	// Paths are bytes on Linux, shown as UTF-8. Invalid sequences decode
+	// to U+FFFD. dst needs room for len characters.
+	static size_t decodeUtf8(const char* src, size_t len, wchar_t* dst)
+	{
+		const unsigned char* s = (const unsigned char*)src;
+		size_t out = 0;
+
+		for (size_t i = 0; i < len; ) {
+			unsigned char c = s[i];
+			size_t extra = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : 4;
+			uint32_t cp = extra == 0 ? c : extra == 1 ? c & 0x1F : extra == 2 ? c & 0x0F : c & 0x07;
+
+			bool valid = extra < 4 && i + extra < len;
+			for (size_t k = 1; valid && k <= extra; ++k) {
+				valid = (s[i + k] & 0xC0) == 0x80;
+				cp = (cp << 6) | (s[i + k] & 0x3F);
+			}
+
+			if (valid) {
+				dst[out++] = (wchar_t)cp;
+				i += extra + 1;
+			}
+			else {
+				dst[out++] = (wchar_t)0xFFFD;
+				++i;
+			}
+		}
+
+		return out;
+	}
+
+private:
+	DIR* m_proc = nullptr;
+};
+
+#endif
+
+void FakeProcessSource::add(const ProcessKey& key, const std::wstring& path, ProcessId parent)
+{
+	const PathId id = PathStore::shared().intern(path.c_str(), path.size());
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_processes[key] = id;
+	m_parents[key] = parent;
+}
+
+void FakeProcessSource::remove(const ProcessKey& key)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_processes.erase(key);
+	m_parents.erase(key);
+}
+
+void FakeProcessSource::clear()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_processes.clear();
+	m_parents.clear();
+	m_lockers.clear();
+	m_openFiles.clear();
+	m_modules.clear();
+}
+
+void FakeProcessSource::setLockers(const std::wstring& file, const std::vector<ProcessKey>& keys)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_lockers[file] = keys;
+}
+
+void FakeProcessSource::setOpenFiles(const ProcessKey& key, const std::vector<std::wstring>& files)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_openFiles[key] = files;
+}
+
+void FakeProcessSource::setModules(const ProcessKey& key, const std::vector<std::wstring>& modules)
+{
+	Modules entry;
+
+	for (auto& module : modules) {
+		entry.paths.push_back(PathStore::shared().intern(module.c_str(), module.size()));
+	}
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	entry.version = m_modules[key].version + 1;
+	m_modules[key] = entry;
+}
+
+bool FakeProcessSource::snapshot(std::vector<ProcessKey>& output, std::vector<ProcessId>& parents)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	for (auto& kv : m_processes) {
+		output.push_back(kv.first);
+		parents.push_back(m_parents[kv.first]);
+	}
+
+	return true;
+}
+
+bool FakeProcessSource::key(ProcessId id, ProcessKey& key)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	// The newest instance of the PID
+	auto it = m_processes.lower_bound({ id + 1, 0 });
+
+	if (it == m_processes.begin() || (--it)->first.id != id) {
+		return false;
+	}
+
+	key = it->first;
+
+	return true;
+}
+
+bool FakeProcessSource::imagePath(const ProcessKey& key, PathId& path)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	auto it = m_processes.find(key);
+
+	if (it == m_processes.end()) {
+		return false;
+	}
+
+	path = it->second;
+
+	return path != InvalidPathId;
+}
+
+bool FakeProcessSource::lockers(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	std::set<ProcessKey> seen;
+
+	for (auto& file : files) {
+		auto it = m_lockers.find(file);
+
+		if (it == m_lockers.end()) {
+			continue;
+		}
+
+		for (auto& key : it->second) {
+			// Lockers which exited are not reported, like Restart Manager
+			if (m_processes.count(key) && seen.insert(key).second) {
+				output.push_back(key);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FakeProcessSource::fileHolders(const std::vector<ProcessKey>& processes, const PatternSet& patterns,
+	std::vector<ProcessKey>& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	for (auto& key : processes) {
+		auto it = m_openFiles.find(key);
+
+		if (it == m_openFiles.end() || !m_processes.count(key)) {
+			continue;
+		}
+
+		for (auto& file : it->second) {
+			if (patterns.match(file.c_str(), file.size())) {
+				output.push_back(key);
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FakeProcessSource::moduleSignature(const ProcessKey& key, uint64_t& signature)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (!m_processes.count(key)) {
+		return false;
+	}
+
+	auto it = m_modules.find(key);
+	signature = it != m_modules.end() ? it->second.version : 0;
+
+	return true;
+}
+
+bool FakeProcessSource::modules(const ProcessKey& key, std::vector<PathId>& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_moduleReads;
+
+	if (!m_processes.count(key)) {
+		return false;
+	}
+
+	auto it = m_modules.find(key);
+
+	if (it != m_modules.end()) {
+		output.insert(output.end(), it->second.paths.begin(), it->second.paths.end());
+	}
+
+	return true;
+}
+
+std::unique_ptr<ProcessSource> ProcessSource::create()
+{
+#ifdef _WIN32
+	return std::make_unique<Win32ProcessSource>();
+#elif defined(__linux__)
+	return std::make_unique<ProcProcessSource>();
+#else
+	return std::make_unique<FakeProcessSource>();
+#endif
+}
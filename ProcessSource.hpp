@@ -0,0 +1,125 @@
+#pragma once
+
+#include "PathStore.hpp"
+#include "PatternSet.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef uint32_t ProcessId;
+
+// Identifies one process instance. PIDs are reused as soon as a process
+// exits, the PID together with the creation time is not.
+//
+// The start time is FILETIME on Windows and clock ticks since boot on
+// Linux. Within one source a process never starts before its parent.
+struct ProcessKey
+{
+	ProcessId id;
+	uint64_t startTime;
+
+	bool operator<(const ProcessKey& other) const
+	{
+		return id < other.id || (id == other.id && startTime < other.startTime);
+	}
+
+	bool operator==(const ProcessKey& other) const
+	{
+		return id == other.id && startTime == other.startTime;
+	}
+};
+
+// Where ProcessList gets its view of the system from.
+//
+// ProcessList only does matching and bookkeeping, everything that talks to
+// the OS goes through here. Backends: NtQuerySystemInformation and Restart
+// Manager on Windows, /proc on Linux, and an in-memory table for benchmarks.
+class ProcessSource
+{
+public:
+	virtual ~ProcessSource() {}
+
+	// Appends every running process, and the PID of its parent to parents
+	// (0 if none). The parent PID may since have been reused.
+	virtual bool snapshot(std::vector<ProcessKey>& output, std::vector<ProcessId>& parents) = 0;
+
+	// Key of the process currently running under a PID
+	virtual bool key(ProcessId id, ProcessKey& key) = 0;
+
+	// Interned image path of a running process. Fails if the process is
+	// gone or its PID now belongs to a different process.
+	virtual bool imagePath(const ProcessKey& key, PathId& path) = 0;
+
+	// Appends the processes which hold any of files open. Returns false if
+	// the backend cannot tell.
+	virtual bool lockers(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output) = 0;
+
+	// Appends the processes among processes which have a file open whose
+	// path matches patterns. The calling process is never reported.
+	// Returns false if the backend cannot tell.
+	virtual bool fileHolders(const std::vector<ProcessKey>& processes, const PatternSet& patterns,
+		std::vector<ProcessKey>& output) = 0;
+
+	// Changes whenever the set of images mapped into a process may have:
+	// the module count on Windows, the size of the executable library
+	// mappings (VmLib) on Linux. Cheap enough to ask every poll.
+	virtual bool moduleSignature(const ProcessKey& key, uint64_t& signature) = 0;
+
+	// Appends the interned paths of the images mapped into a process,
+	// main executable included
+	virtual bool modules(const ProcessKey& key, std::vector<PathId>& output) = 0;
+
+	// Best source for this platform
+	static std::unique_ptr<ProcessSource> create();
+};
+
+// Process table kept in memory, for driving ProcessList without touching
+// the OS. Safe to modify while a ProcessList polls it.
+class FakeProcessSource : public ProcessSource
+{
+public:
+	void add(const ProcessKey& key, const std::wstring& path, ProcessId parent = 0);
+	void remove(const ProcessKey& key);
+	void clear();
+
+	// Processes reported by lockers() for a file
+	void setLockers(const std::wstring& file, const std::vector<ProcessKey>& keys);
+
+	// Files a process has open, for fileHolders()
+	void setOpenFiles(const ProcessKey& key, const std::vector<std::wstring>& files);
+
+	// Images mapped into a process, for modules()
+	void setModules(const ProcessKey& key, const std::vector<std::wstring>& modules);
+
+	bool snapshot(std::vector<ProcessKey>& output, std::vector<ProcessId>& parents) override;
+	bool key(ProcessId id, ProcessKey& key) override;
+	bool imagePath(const ProcessKey& key, PathId& path) override;
+	bool lockers(const std::vector<std::wstring>& files, std::vector<ProcessKey>& output) override;
+	bool fileHolders(const std::vector<ProcessKey>& processes, const PatternSet& patterns,
+		std::vector<ProcessKey>& output) override;
+	bool moduleSignature(const ProcessKey& key, uint64_t& signature) override;
+	bool modules(const ProcessKey& key, std::vector<PathId>& output) override;
+
+	// modules() calls so far
+	size_t moduleReads() const { return m_moduleReads; }
+
+private:
+	std::mutex m_mutex;
+	std::map<ProcessKey, PathId> m_processes;
+	std::map<ProcessKey, ProcessId> m_parents;
+	std::map<std::wstring, std::vector<ProcessKey>> m_lockers;
+	std::map<ProcessKey, std::vector<std::wstring>> m_openFiles;
+
+	struct Modules
+	{
+		uint64_t version = 0;
+		std::vector<PathId> paths;
+	};
+
+	std::map<ProcessKey, Modules> m_modules;
+	size_t m_moduleReads = 0;
+};
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "ProcessTree.hpp"
+
+#include <set>
+
+bool ProcessTree::build(ProcessSource& source)
+{
+	std::vector<ProcessKey> keys;
+	std::vector<ProcessId> parents;
+
+	clear();
+
+	if (!source.snapshot(keys, parents)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		add(keys[i], i < parents.size() ? parents[i] : 0);
+	}
+
+	return true;
+}
+
+void ProcessTree::clear()
+{
+	m_processes.clear();
+	m_parents.clear();
+	m_children.clear();
+}
+
+void ProcessTree::add(const ProcessKey& key, ProcessId parent)
+{
+	m_processes[key.id] = key;
+	m_parents[key.id] = parent;
+
+	// PID 0 is the idle process on Windows and nobody's parent on Linux
+	if (parent && parent != key.id) {
+		m_children.emplace(parent, key);
+	}
+}
+
+const ProcessKey* ProcessTree::parentOf(const ProcessKey& key) const
+{
+	auto parent = m_parents.find(key.id);
+
+	if (parent == m_parents.end() || !parent->second || parent->second == key.id) {
+		return nullptr;
+	}
+
+	auto it = m_processes.find(parent->second);
+
+	// Started after the child: the parent PID was reused
+	if (it == m_processes.end() || key.startTime < it->second.startTime) {
+		return nullptr;
+	}
+
+	return &it->second;
+}
+
+std::vector<ProcessTree::Node> ProcessTree::subtrees(const std::vector<ProcessKey>& roots) const
+{
+	std::vector<ProcessKey> members;
+	std::set<ProcessKey> seen;
+
+	for (auto& root : roots) {
+		auto it = m_processes.find(root.id);
+
+		// Exited, or its PID belongs to another process by now
+		if (it == m_processes.end() || !(it->second == root)) {
+			continue;
+		}
+
+		if (seen.insert(root).second) {
+			members.push_back(root);
+		}
+	}
+
+	// Breadth first, the set keeps a reused PID from closing a cycle
+	for (size_t i = 0; i < members.size(); ++i) {
+		const ProcessKey parent = members[i];
+
+		auto range = m_children.equal_range(parent.id);
+
+		for (auto it = range.first; it != range.second; ++it) {
+			const ProcessKey* actual = parentOf(it->second);
+
+			if (actual && *actual == parent && seen.insert(it->second).second) {
+				members.push_back(it->second);
+			}
+		}
+	}
+
+	std::vector<Node> output;
+	output.reserve(members.size());
+
+	for (auto& key : members) {
+		size_t depth = 0;
+
+		// Up to the topmost ancestor in the set
+		for (const ProcessKey* p = parentOf(key); p && seen.count(*p) && depth < members.size(); p = parentOf(*p)) {
+			++depth;
+		}
+
+		output.push_back({ key, depth });
+	}
+
+	return output;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <map>
+#include <vector>
+
+// Parent/child index of the running processes, built from one snapshot.
+//
+// Parent PIDs are reused like any other, so a process only counts as the
+// child of the current holder of its parent PID if it did not start before
+// it.
+class ProcessTree
+{
+public:
+	// A process of a subtree and its distance from the nearest root
+	struct Node
+	{
+		ProcessKey key;
+		size_t depth;
+	};
+
+	// Replaces the index with a fresh snapshot of source
+	bool build(ProcessSource& source);
+
+	void clear();
+	void add(const ProcessKey& key, ProcessId parent);
+
+	// The running roots and all of their descendants, each once. A root
+	// which descends from another root is treated as its descendant.
+	// Roots come first, in the order given.
+	std::vector<Node> subtrees(const std::vector<ProcessKey>& roots) const;
+
+private:
+	const ProcessKey* parentOf(const ProcessKey& key) const;
+
+private:
+	// Current holder of each PID, and the parent PID it reported
+	std::map<ProcessId, ProcessKey> m_processes;
+	std::map<ProcessId, ProcessId> m_parents;
+
+	// Children by parent PID, not yet checked against reuse
+	std::multimap<ProcessId, ProcessKey> m_children;
+};
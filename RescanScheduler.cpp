@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "RescanScheduler.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Span the CPU budget applies to
+static const auto BudgetWindow = std::chrono::minutes(1);
+
+class SteadySchedulerClock : public SchedulerClock
+{
+public:
+	SchedulerTime now() const override
+	{
+		return std::chrono::steady_clock::now();
+	}
+};
+
+std::unique_ptr<SchedulerClock> SchedulerClock::create()
+{
+	return std::make_unique<SteadySchedulerClock>();
+}
+
+SchedulerTime FakeSchedulerClock::now() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_now;
+}
+
+void FakeSchedulerClock::advance(std::chrono::microseconds duration)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_now += duration;
+}
+
+void FakeSchedulerClock::set(SchedulerTime time)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_now = time;
+}
+
+RescanScheduler::RescanScheduler(std::unique_ptr<SchedulerClock> clock, uint32_t seed) :
+	m_clock(std::move(clock)),
+	m_random(seed)
+{
+	m_created = m_clock->now();
+	m_next = m_created + m_policy.warmup;
+}
+
+void RescanScheduler::setPolicy(const RescanPolicy& policy)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_policy = policy;
+
+	if (m_scans) {
+		plan();
+	}
+	else {
+		m_next = m_created + m_policy.warmup;
+	}
+}
+
+RescanPolicy RescanScheduler::policy() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_policy;
+}
+
+SchedulerTime RescanScheduler::next() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_next;
+}
+
+bool RescanScheduler::due() const
+{
+	return m_clock->now() >= next();
+}
+
+std::chrono::milliseconds RescanScheduler::untilNext() const
+{
+	const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next() - m_clock->now());
+
+	return (std::max)(wait, std::chrono::milliseconds(0));
+}
+
+void RescanScheduler::completed(std::chrono::microseconds duration, std::chrono::microseconds cpu)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	const auto now = m_clock->now();
+
+	++m_scans;
+	m_lastEnd = now;
+	m_lastDuration = duration;
+	m_lastCpu = cpu;
+
+	m_history.push_back({ now - duration, cpu });
+	m_historyCpu += cpu;
+
+	// Only throttle() trims the history otherwise, which it skips without
+	// a budget
+	expire(now);
+
+	plan();
+
+	// A trigger or request which came in while the scan ran may have been
+	// too late for it, and is kept
+	if (m_requested && m_requestTime > now - duration) {
+		m_next = (std::min)(m_next, m_requestDue);
+	}
+
+	m_requested = false;
+}
+
+void RescanScheduler::trigger()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (!m_policy.triggers && m_policy.cadence != RescanPolicy::Triggered) {
+		return;
+	}
+
+	const auto now = m_clock->now();
+
+	request(now, throttle(now + m_policy.triggerDelay));
+}
+
+void RescanScheduler::rescanNow()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	const auto now = m_clock->now();
+
+	request(now, now);
+}
+
+void RescanScheduler::postpone(SchedulerTime time)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_next = (std::max)(m_next, time);
+}
+
+size_t RescanScheduler::scans() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_scans;
+}
+
+std::chrono::microseconds RescanScheduler::cpuUsed() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	const auto since = m_clock->now() - BudgetWindow;
+	std::chrono::microseconds used{ 0 };
+
+	for (auto& scan : m_history) {
+		if (scan.start >= since) {
+			used += scan.cpu;
+		}
+	}
+
+	return used;
+}
+
+std::chrono::microseconds RescanScheduler::threadCpuTime()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return std::chrono::microseconds(0);
+	}
+
+	// 100 ns units
+	const uint64_t total =
+		(((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+		(((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+
+	return std::chrono::microseconds(total / 10);
+#else
+	timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+		return std::chrono::microseconds(0);
+	}
+
+	return std::chrono::microseconds((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+std::chrono::microseconds RescanScheduler::interval()
+{
+	std::chrono::microseconds base;
+
+	switch (m_policy.cadence) {
+	case RescanPolicy::Fixed:
+		base = m_policy.interval;
+		break;
+	case RescanPolicy::Adaptive:
+		base = std::chrono::microseconds((int64_t)(m_lastDuration.count() * m_policy.costFactor));
+		base = (std::max)(base, std::chrono::microseconds(m_policy.minInterval));
+		base = (std::min)(base, std::chrono::microseconds(m_policy.maxInterval));
+		break;
+	default:
+		base = m_policy.maxInterval;
+		break;
+	}
+
+	if (m_policy.jitter > 0) {
+		std::uniform_real_distribution<double> spread(-m_policy.jitter, m_policy.jitter);
+		base = std::chrono::microseconds((int64_t)(base.count() * (1.0 + spread(m_random))));
+	}
+
+	return base;
+}
+
+SchedulerTime RescanScheduler::throttle(SchedulerTime time)
+{
+	if (m_policy.cpuBudget.count() <= 0) {
+		return time;
+	}
+
+	expire(m_clock->now());
+
+	// The next scan is expected to cost what the last one did. Scans leave
+	// the window oldest first until it fits; if it never does, one scan
+	// per window.
+	const std::chrono::microseconds budget = m_policy.cpuBudget;
+	std::chrono::microseconds used = m_historyCpu;
+
+	for (auto& scan : m_history) {
+		if (used + m_lastCpu <= budget) {
+			break;
+		}
+
+		used -= scan.cpu;
+		time = (std::max)(time, scan.start + BudgetWindow);
+	}
+
+	return time;
+}
+
+void RescanScheduler::expire(SchedulerTime now)
+{
+	while (!m_history.empty() && m_history.front().start + BudgetWindow <= now) {
+		m_historyCpu -= m_history.front().cpu;
+		m_history.pop_front();
+	}
+}
+
+void RescanScheduler::plan()
+{
+	m_next = throttle(m_lastEnd + interval());
+}
+
+void RescanScheduler::request(SchedulerTime now, SchedulerTime due)
+{
+	m_next = (std::min)(m_next, due);
+
+	m_requested = true;
+	m_requestTime = now;
+	m_requestDue = m_next;
+}
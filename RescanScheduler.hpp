@@ -0,0 +1,160 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+
+typedef std::chrono::steady_clock::time_point SchedulerTime;
+
+class SchedulerClock
+{
+public:
+	virtual ~SchedulerClock() {}
+
+	virtual SchedulerTime now() const = 0;
+
+	// steady_clock
+	static std::unique_ptr<SchedulerClock> create();
+};
+
+// Moves only when told to, for replaying a schedule faster than real time
+class FakeSchedulerClock : public SchedulerClock
+{
+public:
+	SchedulerTime now() const override;
+
+	void advance(std::chrono::microseconds duration);
+	void set(SchedulerTime time);
+
+private:
+	mutable std::mutex m_mutex;
+	SchedulerTime m_now;
+};
+
+struct RescanPolicy
+{
+	enum Cadence
+	{
+		// A scan every interval
+		Fixed,
+		// The last scan's duration times costFactor, clamped to
+		// minInterval..maxInterval: slow scans run less often
+		Adaptive,
+		// Only on triggers and requests, plus a sweep every maxInterval
+		Triggered
+	};
+
+	Cadence cadence = Adaptive;
+
+	// Until the first scan
+	std::chrono::milliseconds warmup{ 5000 };
+
+	std::chrono::milliseconds interval{ 5000 };
+
+	double costFactor = 5.0;
+	std::chrono::milliseconds minInterval{ 1000 };
+	std::chrono::milliseconds maxInterval{ 10000 };
+
+	// A trigger moves the next scan to triggerDelay from now, later
+	// triggers before it are folded into it. Triggered always honours
+	// triggers, the other cadences only if triggers is set.
+	bool triggers = true;
+	std::chrono::milliseconds triggerDelay{ 0 };
+
+	// Each interval is scaled by a random factor in 1 +/- jitter, so
+	// installers started together do not scan in lockstep
+	double jitter = 0.0;
+
+	// CPU time scans may use in any minute, 0 for no limit. Scans which
+	// would exceed it are put off; rescanNow() is not.
+	std::chrono::milliseconds cpuBudget{ 0 };
+};
+
+// Decides when the owner's next full scan is due.
+//
+// The owner reports every scan it runs with its duration and CPU time
+// and sleeps until next(). Triggers (a process started, an application
+// was closed) and explicit requests bring the next scan forward. Nothing
+// here runs a scan or a thread, so a policy can be replayed against a
+// FakeSchedulerClock and compared on scan cost against detection latency.
+class RescanScheduler
+{
+public:
+	RescanScheduler() : RescanScheduler(SchedulerClock::create(), std::random_device()()) {}
+	RescanScheduler(std::unique_ptr<SchedulerClock> clock, uint32_t seed);
+	RescanScheduler(const RescanScheduler&) = delete;
+	RescanScheduler& operator=(const RescanScheduler&) = delete;
+
+	// Plans the next scan again under the new policy
+	void setPolicy(const RescanPolicy& policy);
+	RescanPolicy policy() const;
+
+	SchedulerTime now() const { return m_clock->now(); }
+	SchedulerTime next() const;
+	bool due() const;
+
+	// Time to sleep until next(), 0 if it is due
+	std::chrono::milliseconds untilNext() const;
+
+	// A scan which just finished
+	void completed(std::chrono::microseconds duration, std::chrono::microseconds cpu);
+
+	// Something may have changed what a scan would find
+	void trigger();
+
+	// Due right away, regardless of the budget
+	void rescanNow();
+
+	// The next scan is no earlier than time, unless a trigger or a request
+	// comes first
+	void postpone(SchedulerTime time);
+
+	size_t scans() const;
+
+	// CPU time of the scans in the last minute
+	std::chrono::microseconds cpuUsed() const;
+
+	// CPU time the calling thread has used so far
+	static std::chrono::microseconds threadCpuTime();
+
+private:
+	struct Scan
+	{
+		SchedulerTime start;
+		std::chrono::microseconds cpu;
+	};
+
+	std::chrono::microseconds interval();
+	SchedulerTime throttle(SchedulerTime time);
+	void expire(SchedulerTime now);
+	void plan();
+	void request(SchedulerTime now, SchedulerTime due);
+
+private:
+	std::unique_ptr<SchedulerClock> m_clock;
+
+	mutable std::mutex m_mutex;
+	RescanPolicy m_policy;
+	std::mt19937 m_random;
+
+	SchedulerTime m_created;
+	SchedulerTime m_next;
+
+	size_t m_scans = 0;
+	SchedulerTime m_lastEnd;
+	std::chrono::microseconds m_lastDuration{ 0 };
+	std::chrono::microseconds m_lastCpu{ 0 };
+
+	// Latest trigger or request, which a scan that started before it
+	// does not satisfy
+	bool m_requested = false;
+	SchedulerTime m_requestTime;
+	SchedulerTime m_requestDue;
+
+	// Scans within the budget window, oldest first
+	std::deque<Scan> m_history;
+	std::chrono::microseconds m_historyCpu{ 0 };
+};
@@ -0,0 +1,326 @@
+#include "stdafx.h"
+#include "Terminator.hpp"
+#include "ExitWatcher.hpp"
+#include "ProcessTree.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#endif
+
+// How often processes the ExitWatcher cannot watch are checked
+static const auto PollInterval = std::chrono::milliseconds(50);
+
+#ifdef _WIN32
+
+class Win32TerminationBackend : public TerminationBackend
+{
+public:
+	Win32TerminationBackend(ProcessSource& source) : m_source(source) {}
+
+	bool requestClose(const ProcessKey& key) override
+	{
+		ProcessKey current;
+		if (!m_source.key(key.id, current) || !(current == key)) {
+			return false;
+		}
+
+		struct Context
+		{
+			DWORD id;
+			bool posted;
+		} context = { key.id, false };
+
+		// What closing the window by hand would do, the process may ask to
+		// save its data
+		EnumWindows([](HWND hwnd, LPARAM lParam) -> BOOL {
+			auto context = (Context*)lParam;
+
+			DWORD owner = 0;
+			GetWindowThreadProcessId(hwnd, &owner);
+
+			if (owner == context->id && IsWindowVisible(hwnd) && PostMessage(hwnd, WM_CLOSE, 0, 0)) {
+				context->posted = true;
+			}
+
+			return TRUE;
+		}, (LPARAM)&context);
+
+		return context.posted;
+	}
+
+	bool kill(const ProcessKey& key, unsigned exitCode) override
+	{
+		HANDLE process = OpenProcess(PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, key.id);
+
+		if (!process) {
+			return false;
+		}
+
+		// The open handle keeps the PID from being reused
+		ProcessKey current;
+		bool result = m_source.key(key.id, current) && current == key &&
+			TerminateProcess(process, exitCode);
+
+		CloseHandle(process);
+
+		return result;
+	}
+
+private:
+	ProcessSource& m_source;
+};
+
+#elif defined(__linux__)
+
+// Signals go through a pidfd, which cannot end up at a process that got
+// the PID later
+class PidfdTerminationBackend : public TerminationBackend
+{
+public:
+	PidfdTerminationBackend(ProcessSource& source) : m_source(source) {}
+
+	bool requestClose(const ProcessKey& key) override
+	{
+		return signal(key, SIGTERM);
+	}
+
+	bool kill(const ProcessKey& key, unsigned) override
+	{
+		// The exit code is the signal's
+		return signal(key, SIGKILL);
+	}
+
+private:
+	bool signal(const ProcessKey& key, int sig)
+	{
+		int fd = (int)syscall(SYS_pidfd_open, (pid_t)key.id, 0);
+
+		if (fd < 0) {
+			return false;
+		}
+
+		ProcessKey current;
+		bool result = m_source.key(key.id, current) && current == key &&
+			syscall(SYS_pidfd_send_signal, fd, sig, nullptr, 0) == 0;
+
+		close(fd);
+
+		return result;
+	}
+
+private:
+	ProcessSource& m_source;
+};
+
+#endif
+
+// Fallback: nothing can be signalled
+class NullTerminationBackend : public TerminationBackend
+{
+public:
+	bool requestClose(const ProcessKey&) override { return false; }
+	bool kill(const ProcessKey&, unsigned) override { return false; }
+};
+
+std::unique_ptr<TerminationBackend> TerminationBackend::create(ProcessSource& source)
+{
+#ifdef _WIN32
+	return std::make_unique<Win32TerminationBackend>(source);
+#elif defined(__linux__)
+	return std::make_unique<PidfdTerminationBackend>(source);
+#else
+	return std::make_unique<NullTerminationBackend>();
+#endif
+}
+
+Terminator::Terminator(ProcessSource& source, std::unique_ptr<TerminationBackend> backend) :
+	m_source(source),
+	m_backend(std::move(backend))
+{
+}
+
+std::vector<TerminationOutcome> Terminator::terminate(const std::vector<ProcessKey>& roots, const Options& options)
+{
+	TraceSpan span("terminate", "terminate");
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto deadline = start + options.deadline;
+
+	std::vector<ProcessKey> targets = roots;
+	std::vector<size_t> depths(targets.size(), 0);
+
+	if (options.tree != TargetsOnly) {
+		// One enumeration for the whole family
+		ProcessTree tree;
+
+		if (tree.build(m_source)) {
+			std::set<ProcessKey> listed(roots.begin(), roots.end());
+
+			for (auto& node : tree.subtrees(roots)) {
+				if (!listed.count(node.key)) {
+					targets.push_back(node.key);
+					depths.push_back(node.depth);
+				}
+				else if (options.tree == LeavesFirst) {
+					// A root below another root
+					auto it = std::find(roots.begin(), roots.end(), node.key);
+					depths[it - roots.begin()] = node.depth;
+				}
+			}
+		}
+	}
+
+	std::vector<TerminationOutcome> outcomes;
+
+	for (auto& key : targets) {
+		outcomes.push_back({ key, TerminationOutcome::TimedOut });
+	}
+
+	std::mutex mutex;
+	std::condition_variable exitEvent;
+	std::set<ProcessKey> exited;
+
+	// Declared after what its callback uses, destroyed before it
+	auto watcher = ExitWatcher::create(m_source, [&](const ProcessKey& key) {
+		std::lock_guard<std::mutex> guard(mutex);
+
+		exited.insert(key);
+		exitEvent.notify_all();
+	});
+
+	auto running = [this](const ProcessKey& key) {
+		ProcessKey current;
+		return m_source.key(key.id, current) && current == key;
+	};
+
+	// Targets still running, and how each of them is observed
+	std::vector<size_t> pending;
+	std::vector<char> polled(targets.size(), 0);
+	std::vector<char> killed(targets.size(), 0);
+	std::vector<char> killFailed(targets.size(), 0);
+
+	for (size_t i = 0; i < targets.size(); ++i) {
+		if (watcher->watch(targets[i])) {
+			pending.push_back(i);
+		}
+		else if (running(targets[i])) {
+			polled[i] = true;
+			pending.push_back(i);
+		}
+		else {
+			outcomes[i].result = TerminationOutcome::AlreadyExited;
+		}
+	}
+
+	auto sendKill = [&](size_t i) {
+		killed[i] = true;
+		killFailed[i] = !m_backend->kill(targets[i], options.exitCode);
+	};
+
+	// Waits until every target of batch exited or until, whichever is first
+	auto waitUntil = [&](std::vector<size_t>& batch, std::chrono::steady_clock::time_point until) {
+		TraceSpan span("terminate_wait", "terminate");
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		for (;;) {
+			batch.erase(std::remove_if(batch.begin(), batch.end(), [&](size_t i) {
+				if (polled[i] ? running(targets[i]) : !exited.count(targets[i])) {
+					return false;
+				}
+
+				outcomes[i].result = killed[i] ? TerminationOutcome::Killed : TerminationOutcome::Closed;
+				return true;
+			}), batch.end());
+
+			const auto now = std::chrono::steady_clock::now();
+
+			if (batch.empty() || now >= until) {
+				return;
+			}
+
+			const bool polling = std::any_of(batch.begin(), batch.end(), [&](size_t i) { return polled[i]; });
+
+			exitEvent.wait_until(lock, polling ? (std::min)(until, now + PollInterval) : until);
+		}
+	};
+
+	// Graceful request, then the hard kill, for one batch
+	auto run = [&](std::vector<size_t>& batch) {
+		if (options.graceful.count() > 0) {
+			for (size_t i : batch) {
+				// Nothing to ask politely, no point in waiting for it
+				if (!m_backend->requestClose(targets[i])) {
+					sendKill(i);
+				}
+			}
+
+			waitUntil(batch, (std::min)(std::chrono::steady_clock::now() + options.graceful, deadline));
+		}
+
+		for (size_t i : batch) {
+			if (!killed[i]) {
+				sendKill(i);
+			}
+		}
+
+		waitUntil(batch, deadline);
+	};
+
+	std::vector<std::vector<size_t>> batches;
+
+	if (options.tree == LeavesFirst) {
+		size_t maxDepth = 0;
+
+		for (size_t i : pending) {
+			maxDepth = (std::max)(maxDepth, depths[i]);
+		}
+
+		for (size_t depth = maxDepth + 1; depth-- > 0; ) {
+			batches.emplace_back();
+
+			for (size_t i : pending) {
+				if (depths[i] == depth) {
+					batches.back().push_back(i);
+				}
+			}
+		}
+	}
+	else {
+		batches.push_back(pending);
+	}
+
+	std::vector<size_t> unfinished;
+
+	for (auto& batch : batches) {
+		run(batch);
+
+		unfinished.insert(unfinished.end(), batch.begin(), batch.end());
+	}
+
+	for (size_t i : unfinished) {
+		if (killFailed[i]) {
+			outcomes[i].result = TerminationOutcome::Failed;
+		}
+	}
+
+	return outcomes;
+}
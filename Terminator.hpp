@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Asks processes to exit. Both calls only signal and return at once.
+class TerminationBackend
+{
+public:
+	virtual ~TerminationBackend() {}
+
+	// Graceful: WM_CLOSE to the process's top-level windows on Windows,
+	// SIGTERM on Linux. Fails if the process has no way to be asked.
+	virtual bool requestClose(const ProcessKey& key) = 0;
+
+	// Hard: TerminateProcess or SIGKILL
+	virtual bool kill(const ProcessKey& key, unsigned exitCode) = 0;
+
+	// source tells whether a PID still belongs to the process to signal
+	static std::unique_ptr<TerminationBackend> create(ProcessSource& source);
+};
+
+struct TerminationOutcome
+{
+	enum Result
+	{
+		// Gone before anything was sent
+		AlreadyExited,
+		// Exited after the graceful request
+		Closed,
+		// Exited after the hard kill
+		Killed,
+		// Could not be signalled at all
+		Failed,
+		// Still running at the deadline
+		TimedOut
+	};
+
+	ProcessKey key;
+	Result result;
+};
+
+// Terminates a set of processes concurrently against one deadline.
+//
+// Every target is signalled before any is waited for, and the waits share
+// a single deadline, so closing takes as long as the slowest process and
+// never longer than the deadline; a hung process cannot stall the
+// installer. Exits are observed through an ExitWatcher, processes it
+// cannot watch are polled. Descendants of the targets are found through a
+// ProcessTree built when terminate() is called.
+class Terminator
+{
+public:
+	enum TreeMode
+	{
+		// Only the targets
+		TargetsOnly,
+		// Targets and their descendants, deepest first: each generation
+		// goes through the graceful and hard phases before its parents
+		// are signalled, so no parent is left to restart a child
+		LeavesFirst,
+		// Targets and their descendants, all in one batch
+		AllAtOnce
+	};
+
+	struct Options
+	{
+		// Whether the children of targets are terminated too. Children
+		// such as crash handlers and helpers keep files locked as well.
+		TreeMode tree = TargetsOnly;
+
+		// Time given to the graceful request before the hard kill, 0 kills
+		// right away. Per generation with LeavesFirst.
+		std::chrono::milliseconds graceful{ 0 };
+
+		// Overall bound, graceful phase included
+		std::chrono::milliseconds deadline{ 10000 };
+
+		unsigned exitCode = 255;
+	};
+
+	Terminator(ProcessSource& source) : Terminator(source, TerminationBackend::create(source)) {}
+	Terminator(ProcessSource& source, std::unique_ptr<TerminationBackend> backend);
+
+	// One outcome per target, in the order of targets, followed by one
+	// per descendant when the tree is terminated
+	std::vector<TerminationOutcome> terminate(const std::vector<ProcessKey>& targets, const Options& options);
+
+private:
+	ProcessSource& m_source;
+	std::unique_ptr<TerminationBackend> m_backend;
+};
@@ -0,0 +1,309 @@
+#include "stdafx.h"
+#include "DirectoryWatcher.hpp"
+#include "FileScanner.hpp"
+#include "ProcessList.hpp"
+#include "ProcessSource.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#endif
+
+// Regression tests for the scan engine, run by ctest. Each test is picked
+// by name on the command line, without one every test runs. A failed
+// check is printed and the exit code is non-zero.
+
+static bool check(bool condition, const char* what)
+{
+	if (!condition) {
+		fprintf(stderr, "FAILED: %s\n", what);
+	}
+
+	return condition;
+}
+
+// Every allocation made by the process
+static std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	++allocationCount;
+
+	void* p = malloc(size ? size : 1);
+
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	::operator delete(p);
+}
+
+#ifdef __linux__
+
+// Directory opens, reads and stats made through libc by the process,
+// std::filesystem included
+static std::atomic<size_t> directoryCalls(0);
+
+template <typename Fn>
+static Fn next(const char* name)
+{
+	return (Fn)dlsym(RTLD_NEXT, name);
+}
+
+extern "C" DIR* opendir(const char* name)
+{
+	static auto real = next<DIR* (*)(const char*)>("opendir");
+
+	++directoryCalls;
+
+	return real(name);
+}
+
+extern "C" DIR* fdopendir(int fd)
+{
+	static auto real = next<DIR* (*)(int)>("fdopendir");
+
+	++directoryCalls;
+
+	return real(fd);
+}
+
+extern "C" struct dirent* readdir(DIR* dir)
+{
+	static auto real = next<struct dirent* (*)(DIR*)>("readdir");
+
+	++directoryCalls;
+
+	return real(dir);
+}
+
+extern "C" int stat(const char* path, struct stat* buf) noexcept
+{
+	static auto real = next<int (*)(const char*, struct stat*)>("stat");
+
+	++directoryCalls;
+
+	return real(path, buf);
+}
+
+extern "C" int lstat(const char* path, struct stat* buf) noexcept
+{
+	static auto real = next<int (*)(const char*, struct stat*)>("lstat");
+
+	++directoryCalls;
+
+	return real(path, buf);
+}
+
+// A scan of a tree which did not change since the previous scan touches
+// no directory at all: the watcher vouches for every cached listing.
+static bool testDirectoryIo()
+{
+	const auto root = std::filesystem::temp_directory_path() / "NSISLockDetectorDirectoryIoTest";
+	std::error_code ec;
+
+	std::filesystem::remove_all(root, ec);
+
+	for (size_t i = 0; i < 20; ++i) {
+		const auto directory = root / ("dir" + std::to_string(i)) / "bin";
+
+		std::filesystem::create_directories(directory, ec);
+
+		for (size_t k = 0; k < 5; ++k) {
+			std::ofstream(directory / ("file" + std::to_string(k) + ".dll"));
+		}
+	}
+
+	FileScanner scanner;
+	scanner.setPatterns({ (root / "*.dll").wstring() });
+
+	std::vector<std::wstring> files;
+	scanner.scan(files);
+
+	bool ok = check(files.size() == 100, "first scan finds every file");
+
+	for (size_t i = 0; i < 5; ++i) {
+		const size_t calls = directoryCalls;
+
+		files.clear();
+		scanner.scan(files);
+
+		ok = check(directoryCalls == calls, "unchanged tree: no directory calls") && ok;
+		ok = check(files.size() == 100, "unchanged tree: same files") && ok;
+	}
+
+	// The counter sees the scanner's reads at all
+	std::ofstream(root / "dir3" / "bin" / "added.dll");
+
+	const size_t calls = directoryCalls;
+
+	files.clear();
+	scanner.scan(files);
+
+	ok = check(directoryCalls > calls, "changed directory is read again") && ok;
+	ok = check(files.size() == 101, "added file is found") && ok;
+
+	std::filesystem::remove_all(root, ec);
+
+	return ok;
+}
+
+#endif
+
+static bool listed(const ProcessList& list, const ProcessKey& key)
+{
+	const auto snapshot = list.snapshot();
+
+	return std::any_of(snapshot->processes.begin(), snapshot->processes.end(),
+		[&key](const ProcessListItem& p) { return p->key() == key; });
+}
+
+// A process listed in one mode is unlisted by the first scan in a mode
+// which does not report it
+static bool testModeChange()
+{
+	auto source = std::make_unique<FakeProcessSource>();
+	FakeProcessSource& table = *source;
+
+	const ProcessKey holder = { 4, 1 };
+	const ProcessKey idle = { 8, 2 };
+
+	table.add(holder, L"C:\\App\\app.exe");
+	table.add(idle, L"C:\\App\\helper.exe");
+	table.setOpenFiles(holder, { L"C:\\App\\data.dll" });
+
+	ProcessList list(PsList, std::move(source), false);
+	list.addPatterns({ L"C:\\App\\*.*" });
+
+	bool ok = check(listed(list, holder) && listed(list, idle), "pslist lists both images");
+
+	list.setMode(OpenFiles);
+	list.update();
+
+	ok = check(listed(list, holder), "openfiles lists the holder") && ok;
+	ok = check(!listed(list, idle), "openfiles unlists the process holding nothing") && ok;
+
+	return ok;
+}
+
+// An exclusion added later unlists the processes it matches
+static bool testExclusion()
+{
+	auto source = std::make_unique<FakeProcessSource>();
+	FakeProcessSource& table = *source;
+
+	const ProcessKey app = { 4, 1 };
+	const ProcessKey helper = { 8, 2 };
+
+	table.add(app, L"/opt/app/app.exe");
+	table.add(helper, L"/opt/app/helper.exe");
+
+	ProcessList list(PsList, std::move(source), false);
+	list.addPatterns({ L"/opt/app/*.exe" });
+
+	bool ok = check(listed(list, app) && listed(list, helper), "both images listed");
+
+	list.addPatterns({ L"!/opt/app/app.exe" });
+
+	ok = check(!listed(list, app), "excluded process unlisted") && ok;
+	ok = check(listed(list, helper), "other process stays listed") && ok;
+
+	return ok;
+}
+
+// Once the cache is warm, a poll which finds no change allocates nothing
+static bool testPollAllocations()
+{
+	bool ok = true;
+
+	for (ProcessListMode mode : { PsList, OpenFiles, Modules }) {
+		auto source = std::make_unique<FakeProcessSource>();
+		FakeProcessSource& table = *source;
+
+		for (ProcessId i = 1; i <= 1000; ++i) {
+			const ProcessKey key = { i * 4, i };
+
+			table.add(key, i % 2 ? L"C:\\App\\app.exe" : L"C:\\Other\\other.exe");
+			table.setOpenFiles(key, { L"C:\\App\\data.dll" });
+			table.setModules(key, { L"C:\\App\\data.dll" });
+		}
+
+		ProcessList list(mode, std::move(source), false);
+		list.addPatterns({ L"C:\\App\\*.*" });
+		list.update();
+
+		const size_t allocations = allocationCount;
+
+		for (size_t i = 0; i < 20; ++i) {
+			list.update();
+		}
+
+		ok = check(allocationCount == allocations, "steady-state poll allocates nothing") && ok;
+	}
+
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	struct Test
+	{
+		const char* name;
+		bool (*run)();
+	};
+
+	static const Test tests[] = {
+#ifdef __linux__
+		{ "directory-io", testDirectoryIo },
+#endif
+		{ "mode-change", testModeChange },
+		{ "exclusion", testExclusion },
+		{ "poll-allocations", testPollAllocations },
+		{ nullptr, nullptr },
+	};
+
+	bool ok = true;
+	bool found = false;
+
+	for (const Test* test = tests; test->name; ++test) {
+		if (argc > 1 && strcmp(argv[1], test->name)) {
+			continue;
+		}
+
+		found = true;
+
+		if (!test->run()) {
+			fprintf(stderr, "%s failed\n", test->name);
+			ok = false;
+		}
+	}
+
+	if (argc > 1 && !found) {
+		fprintf(stderr, "no test named %s\n", argv[1]);
+		return 1;
+	}
+
+	return ok ? 0 : 1;
+}
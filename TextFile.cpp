@@ -0,0 +1,31 @@
+#include "stdafx.h"
+#include "TextFile.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+bool writeTextFile(const std::wstring& path, const std::string& text)
+{
+	FILE* file = nullptr;
+
+#ifdef _WIN32
+	if (_wfopen_s(&file, path.c_str(), L"w") != 0) {
+		file = nullptr;
+	}
+#else
+	std::vector<char> narrow(path.size() * MB_CUR_MAX + 1);
+
+	if (wcstombs(narrow.data(), path.c_str(), narrow.size()) != (size_t)-1) {
+		file = fopen(narrow.data(), "w");
+	}
+#endif
+
+	if (!file) {
+		return false;
+	}
+
+	const bool result = fwrite(text.data(), 1, text.size(), file) == text.size();
+
+	return fclose(file) == 0 && result;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// Replaces the file at path with text. Returns false if it cannot be
+// opened or written in full.
+bool writeTextFile(const std::wstring& path, const std::string& text);
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+#include "Trace.hpp"
+#include "TextFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+thread_local Trace::Ring* Trace::t_ring = nullptr;
+thread_local const char* Trace::t_name = nullptr;
+
+Trace& Trace::shared()
+{
+	static Trace* trace = new Trace();
+
+	return *trace;
+}
+
+void Trace::start(size_t capacity)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (!m_started) {
+		m_started = true;
+		m_origin = std::chrono::steady_clock::now();
+		m_capacity = (std::max)(capacity, (size_t)1);
+	}
+
+	m_enabled.store(true, std::memory_order_release);
+}
+
+void Trace::stop()
+{
+	m_enabled.store(false, std::memory_order_release);
+}
+
+Trace::Ring* Trace::ring()
+{
+	if (!t_ring) {
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		m_rings.push_back(std::make_unique<Ring>(m_capacity, (uint32_t)m_rings.size() + 1));
+		m_rings.back()->name = t_name;
+
+		t_ring = m_rings.back().get();
+	}
+
+	return t_ring;
+}
+
+void Trace::nameThread(const char* name)
+{
+	t_name = name;
+
+	if (t_ring) {
+		t_ring->name = name;
+	}
+}
+
+void Trace::complete(const char* name, const char* category,
+	std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	Ring* r = ring();
+
+	const uint64_t head = r->head.load(std::memory_order_relaxed);
+
+	// Readers which see any of the new fields see the reservation too
+	r->reserved.store(head + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	Event& event = r->events[head % r->events.size()];
+
+	event.name.store(name, std::memory_order_relaxed);
+	event.category.store(category, std::memory_order_relaxed);
+	event.start.store(std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_origin).count(), std::memory_order_relaxed);
+	event.duration.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+
+	r->head.store(head + 1, std::memory_order_release);
+}
+
+std::string Trace::json()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+#ifdef _WIN32
+	const unsigned long pid = GetCurrentProcessId();
+#else
+	const unsigned long pid = (unsigned long)getpid();
+#endif
+
+	std::string output = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	char buf[512];
+
+	auto append = [&](const char* text) {
+		if (!first) {
+			output += ",\n";
+		}
+
+		output += text;
+		first = false;
+	};
+
+	for (auto& r : m_rings) {
+		const char* threadName = r->name.load(std::memory_order_relaxed);
+
+		if (threadName) {
+			snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				pid, r->tid, threadName);
+			append(buf);
+		}
+
+		const size_t capacity = r->events.size();
+		const uint64_t end = r->head.load(std::memory_order_acquire);
+		const uint64_t begin = end > capacity ? end - capacity : 0;
+
+		struct Copy
+		{
+			const char* name;
+			const char* category;
+			int64_t start;
+			int64_t duration;
+		};
+
+		std::vector<Copy> copies;
+		copies.reserve((size_t)(end - begin));
+
+		for (uint64_t i = begin; i < end; ++i) {
+			const Event& event = r->events[i % capacity];
+
+			copies.push_back({
+				event.name.load(std::memory_order_relaxed),
+				event.category.load(std::memory_order_relaxed),
+				event.start.load(std::memory_order_relaxed),
+				event.duration.load(std::memory_order_relaxed) });
+		}
+
+		// Slots the thread started to overwrite while they were copied
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t reserved = r->reserved.load(std::memory_order_relaxed);
+		const uint64_t valid = reserved > capacity ? reserved - capacity : 0;
+
+		for (uint64_t i = (std::max)(begin, valid); i < end; ++i) {
+			const Copy& event = copies[(size_t)(i - begin)];
+
+			snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				event.name, event.category, pid, r->tid, event.start / 1000.0, event.duration / 1000.0);
+			append(buf);
+		}
+	}
+
+	output += "]}\n";
+
+	return output;
+}
+
+bool Trace::write(const std::wstring& path)
+{
+	return writeTextFile(path, json());
+}
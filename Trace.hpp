@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Optional timeline of the engine's activity, written as Chrome
+// trace-event JSON which chrome://tracing and Perfetto open.
+//
+// Off until start() is called; a span then costs a relaxed load when off.
+// Each thread records into its own fixed-size ring, without locks, keeping
+// its most recent events. Rings outlive their threads, so a write() at
+// unload still has the spans of workers that are gone.
+class Trace
+{
+public:
+	// Events kept per thread
+	static const size_t DefaultCapacity = 16384;
+
+	Trace() {}
+	Trace(const Trace&) = delete;
+	Trace& operator=(const Trace&) = delete;
+
+	static Trace& shared();
+
+	static bool enabled() { return shared().m_enabled.load(std::memory_order_acquire); }
+
+	void start(size_t capacity = DefaultCapacity);
+	void stop();
+
+	// name and category are kept as pointers: string literals only
+	void complete(const char* name, const char* category,
+		std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+	// Names the calling thread in the timeline. Cheap enough to call when
+	// tracing is off, for threads that start before it is turned on.
+	static void nameThread(const char* name);
+
+	// Every ring's events, oldest first per thread
+	bool write(const std::wstring& path);
+	std::string json();
+
+private:
+	struct Event
+	{
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<const char*> category{ nullptr };
+		std::atomic<int64_t> start{ 0 };
+		std::atomic<int64_t> duration{ 0 };
+	};
+
+	// Written by its thread only. head counts the events recorded, the
+	// ring keeps the last capacity of them. reserved runs one ahead while
+	// an event is being written, so a reader can tell which slots it may
+	// have seen half overwritten.
+	struct Ring
+	{
+		Ring(size_t capacity, uint32_t tid) : events(capacity), tid(tid) {}
+
+		std::vector<Event> events;
+		std::atomic<uint64_t> reserved{ 0 };
+		std::atomic<uint64_t> head{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		uint32_t tid;
+	};
+
+	Ring* ring();
+
+private:
+	// The calling thread's ring, and its name until the ring exists
+	static thread_local Ring* t_ring;
+	static thread_local const char* t_name;
+
+	std::atomic<bool> m_enabled{ false };
+
+	// Set by the first start() only
+	bool m_started = false;
+	std::chrono::steady_clock::time_point m_origin;
+	size_t m_capacity = DefaultCapacity;
+
+	// Only taken when a thread records its first event and by json()
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<Ring>> m_rings;
+};
+
+// Records the time from construction to destruction as a span of the
+// calling thread, if tracing is on
+class TraceSpan
+{
+public:
+	TraceSpan(const char* name, const char* category) :
+		m_name(name),
+		m_category(category),
+		m_enabled(Trace::enabled())
+	{
+		if (m_enabled) {
+			m_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (m_enabled) {
+			Trace::shared().complete(m_name, m_category, m_start, std::chrono::steady_clock::now());
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* m_name;
+	const char* m_category;
+	bool m_enabled;
+	std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "WindowIndex.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef _WIN32
+
+class Win32WindowSource : public WindowSource
+{
+public:
+	bool enumerate(std::vector<WindowInfo>& output) override
+	{
+		return EnumWindows(add, (LPARAM)&output) != FALSE;
+	}
+
+	bool title(WindowHandle window, std::wstring& output) override
+	{
+		int len = GetWindowTextLengthW((HWND)window);
+
+		if (len <= 0) {
+			return false;
+		}
+
+		// The title may change between the two calls
+		output.resize((size_t)len + 1);
+		len = GetWindowTextW((HWND)window, &output[0], len + 1);
+		output.resize(len > 0 ? (size_t)len : 0);
+
+		return !output.empty();
+	}
+
+private:
+	static BOOL CALLBACK add(HWND hwnd, LPARAM lParam)
+	{
+		auto output = (std::vector<WindowInfo>*)lParam;
+
+		DWORD owner = 0;
+		GetWindowThreadProcessId(hwnd, &owner);
+
+		output->push_back({ (WindowHandle)hwnd, (ProcessId)owner, IsWindowVisible(hwnd) != FALSE });
+
+		return TRUE;
+	}
+};
+
+#endif
+
+// Fallback: no windows
+class NullWindowSource : public WindowSource
+{
+public:
+	bool enumerate(std::vector<WindowInfo>&) override { return true; }
+	bool title(WindowHandle, std::wstring&) override { return false; }
+};
+
+std::unique_ptr<WindowSource> WindowSource::create()
+{
+#ifdef _WIN32
+	return std::make_unique<Win32WindowSource>();
+#else
+	return std::make_unique<NullWindowSource>();
+#endif
+}
+
+void FakeWindowSource::add(const WindowInfo& window, const std::wstring& title)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_windows.push_back(window);
+	m_titles[window.handle] = title;
+}
+
+void FakeWindowSource::clear()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	m_windows.clear();
+	m_titles.clear();
+}
+
+bool FakeWindowSource::enumerate(std::vector<WindowInfo>& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_enumerations;
+	output.insert(output.end(), m_windows.begin(), m_windows.end());
+
+	return true;
+}
+
+bool FakeWindowSource::title(WindowHandle window, std::wstring& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_titleReads;
+
+	auto it = m_titles.find(window);
+
+	if (it == m_titles.end() || it->second.empty()) {
+		return false;
+	}
+
+	output = it->second;
+
+	return true;
+}
+
+WindowIndex& WindowIndex::shared()
+{
+	static WindowIndex* index = new WindowIndex(WindowSource::create());
+
+	return *index;
+}
+
+bool WindowIndex::refresh()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	++m_generation;
+	m_windows.clear();
+
+	m_scratch.clear();
+
+	if (!m_source->enumerate(m_scratch)) {
+		return false;
+	}
+
+	for (auto& window : m_scratch) {
+		if (!window.visible) {
+			continue;
+		}
+
+		// Topmost visible window wins, later ones are behind it
+		Window& entry = m_windows[window.owner];
+
+		if (!entry.handle) {
+			entry.handle = window.handle;
+		}
+	}
+
+	return true;
+}
+
+size_t WindowIndex::generation() const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	return m_generation;
+}
+
+WindowHandle WindowIndex::mainWindow(ProcessId id) const
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	auto it = m_windows.find(id);
+
+	return it != m_windows.end() ? it->second.handle : 0;
+}
+
+bool WindowIndex::mainWindowTitle(ProcessId id, std::wstring& output)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	auto it = m_windows.find(id);
+
+	if (it == m_windows.end()) {
+		return false;
+	}
+
+	Window& window = it->second;
+
+	if (!window.titleLoaded) {
+		m_source->title(window.handle, window.title);
+		window.titleLoaded = true;
+	}
+
+	output = window.title;
+
+	return !output.empty();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ProcessSource.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef uintptr_t WindowHandle;
+
+struct WindowInfo
+{
+	WindowHandle handle;
+	ProcessId owner;
+	bool visible;
+};
+
+// The top-level windows of the desktop
+class WindowSource
+{
+public:
+	virtual ~WindowSource() {}
+
+	// Top-level windows in Z order, topmost first
+	virtual bool enumerate(std::vector<WindowInfo>& output) = 0;
+	virtual bool title(WindowHandle window, std::wstring& output) = 0;
+
+	// EnumWindows on Windows. Elsewhere there are no windows.
+	static std::unique_ptr<WindowSource> create();
+};
+
+// Synthetic window list
+class FakeWindowSource : public WindowSource
+{
+public:
+	void add(const WindowInfo& window, const std::wstring& title);
+	void clear();
+
+	bool enumerate(std::vector<WindowInfo>& output) override;
+	bool title(WindowHandle window, std::wstring& output) override;
+
+	size_t enumerations() const { return m_enumerations; }
+	size_t titleReads() const { return m_titleReads; }
+
+private:
+	std::mutex m_mutex;
+	std::vector<WindowInfo> m_windows;
+	std::map<WindowHandle, std::wstring> m_titles;
+	size_t m_enumerations = 0;
+	size_t m_titleReads = 0;
+};
+
+// Main window of every process, built in one pass over the window list.
+//
+// Looking up each listed process on its own walks all windows once per
+// process; the index walks them once per refresh. The main window of a
+// process is its topmost visible top-level window. Titles are read when
+// first asked for and kept until the next refresh.
+class WindowIndex
+{
+public:
+	WindowIndex(std::unique_ptr<WindowSource> source) : m_source(std::move(source)) {}
+	WindowIndex(const WindowIndex&) = delete;
+	WindowIndex& operator=(const WindowIndex&) = delete;
+
+	// Index shared by every Process
+	static WindowIndex& shared();
+
+	// Rebuilds the index, the generation goes up even if it fails
+	bool refresh();
+
+	// 0 until the first refresh
+	size_t generation() const;
+
+	// 0 if the process has no visible window
+	WindowHandle mainWindow(ProcessId id) const;
+	bool mainWindowTitle(ProcessId id, std::wstring& output);
+
+private:
+	struct Window
+	{
+		WindowHandle handle = 0;
+		bool titleLoaded = false;
+		std::wstring title;
+	};
+
+private:
+	std::unique_ptr<WindowSource> m_source;
+
+	mutable std::mutex m_mutex;
+	std::map<ProcessId, Window> m_windows;
+	std::vector<WindowInfo> m_scratch;
+	size_t m_generation = 0;
+};